@@ -0,0 +1,251 @@
+/*
+ * Copyright (C) 2006-2020 Istituto Italiano di Tecnologia (IIT)
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms of the
+ * BSD-3-Clause license. See the accompanying LICENSE file for details.
+ */
+
+// Drives the getters of a realsense2 device at the maximum rate, usually on a `.bag` recording
+// played back through `playbackFile`, and reports for each configuration the loop iterations per second
+// and the heap allocations per iteration, each iteration calling every available getter once, and the
+// latency percentiles and the allocations of each getter.
+
+#include <yarp/dev/IRGBDSensor.h>
+#include <yarp/dev/MultipleAnalogSensorsInterfaces.h>
+#include <yarp/dev/PolyDriver.h>
+#include <yarp/os/Network.h>
+#include <yarp/os/Property.h>
+#include <yarp/sig/Image.h>
+#include <yarp/sig/Vector.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+namespace {
+// Allocations of the whole process, librealsense and the acquisition threads included
+std::atomic<uint64_t> allocations{0};
+
+using steadyClock = std::chrono::steady_clock;
+
+struct configuration
+{
+    std::string name;
+    std::string options;
+    std::string settings;
+};
+
+// One getter, with the latency of each call in milliseconds and the allocations made while it ran
+struct getterSamples
+{
+    std::string         name;
+    std::vector<double> latencies;
+    uint64_t            allocations{0};
+};
+
+template <typename F>
+bool measure(getterSamples& samples, F call)
+{
+    uint64_t before = allocations.load(std::memory_order_relaxed);
+    auto     start  = steadyClock::now();
+    bool     ok     = call();
+    auto     end    = steadyClock::now();
+    samples.allocations += allocations.load(std::memory_order_relaxed) - before;
+    samples.latencies.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+    return ok;
+}
+
+double percentile(const std::vector<double>& sorted, double p)
+{
+    if (sorted.empty())
+    {
+        return 0.0;
+    }
+    return sorted[static_cast<size_t>(p * (sorted.size() - 1) + 0.5)];
+}
+
+void report(const configuration& cfg, const std::string& resolution, size_t iterations, double seconds, uint64_t totalAllocations,
+            std::vector<getterSamples>& getters)
+{
+    std::printf("%-10s %-10s %8.1f iterations/s %10.1f allocs/iteration\n", cfg.name.c_str(), resolution.c_str(),
+                seconds > 0 ? iterations / seconds : 0.0, iterations ? static_cast<double>(totalAllocations) / iterations : 0.0);
+    for (auto& g : getters)
+    {
+        if (g.latencies.empty())
+        {
+            continue;
+        }
+        std::sort(g.latencies.begin(), g.latencies.end());
+        std::printf("    %-16s p50 %7.3f ms  p90 %7.3f ms  p99 %7.3f ms  max %7.3f ms  %8.1f allocs/call\n", g.name.c_str(),
+                    percentile(g.latencies, 0.5), percentile(g.latencies, 0.9), percentile(g.latencies, 0.99), g.latencies.back(),
+                    static_cast<double>(g.allocations) / g.latencies.size());
+    }
+}
+
+bool run(const yarp::os::Property& args, const configuration& cfg, const std::string& resolution, bool& hasImages)
+{
+    std::string text = "(device " + args.check("device", yarp::os::Value("realsense2withIMU")).asString() + ") " + cfg.options;
+    if (args.check("playbackFile"))
+    {
+        text += " (playbackFile \"" + args.find("playbackFile").asString() + "\")";
+    }
+    text += " (SETTINGS (depthResolution " + resolution + ") (rgbResolution " + resolution + ")";
+    text += " (framerate " + std::to_string(args.check("framerate", yarp::os::Value(30)).asInt32()) + ") " + cfg.settings + ")";
+    text += " (HW_DESCRIPTION (clipPlanes (0.2 10.0)))";
+
+    yarp::os::Property options;
+    options.fromString(text);
+
+    yarp::dev::PolyDriver driver;
+    if (!driver.open(options))
+    {
+        std::fprintf(stderr, "Failed to open the device with %s\n", text.c_str());
+        return false;
+    }
+
+    yarp::dev::IRGBDSensor*                    rgbd{nullptr};
+    yarp::dev::IThreeAxisGyroscopes*           gyro{nullptr};
+    yarp::dev::IThreeAxisLinearAccelerometers* accel{nullptr};
+    yarp::dev::IOrientationSensors*            orientation{nullptr};
+    yarp::dev::IPositionSensors*               position{nullptr};
+    driver.view(rgbd);
+    driver.view(gyro);
+    driver.view(accel);
+    driver.view(orientation);
+    driver.view(position);
+    hasImages = rgbd != nullptr;
+
+    std::vector<getterSamples> getters(6);
+    getters[0].name = "getImages";
+    getters[1].name = "getDepthImage";
+    getters[2].name = "gyroscope";
+    getters[3].name = "accelerometer";
+    getters[4].name = "orientation";
+    getters[5].name = "position";
+
+    yarp::sig::FlexImage                      color;
+    yarp::sig::ImageOf<yarp::sig::PixelFloat> depth;
+    yarp::sig::Vector                         value(3);
+    double                                    stamp{0.0};
+
+    const size_t iterations = static_cast<size_t>(args.check("iterations", yarp::os::Value(300)).asInt32());
+    size_t       done       = 0;
+    uint64_t     before     = allocations.load(std::memory_order_relaxed);
+    auto         start      = steadyClock::now();
+    for (; done < iterations; done++)
+    {
+        bool ok = true;
+        if (rgbd)
+        {
+            ok = measure(getters[0], [&] { return rgbd->getImages(color, depth); }) &&
+                 measure(getters[1], [&] { return rgbd->getDepthImage(depth); });
+        }
+        if (gyro)
+        {
+            ok = measure(getters[2], [&] { return gyro->getThreeAxisGyroscopeMeasure(0, value, stamp); }) && ok;
+        }
+        if (accel)
+        {
+            ok = measure(getters[3], [&] { return accel->getThreeAxisLinearAccelerometerMeasure(0, value, stamp); }) && ok;
+        }
+        if (orientation)
+        {
+            ok = measure(getters[4], [&] { return orientation->getOrientationSensorMeasureAsRollPitchYaw(0, value, stamp); }) && ok;
+        }
+        if (position)
+        {
+            ok = measure(getters[5], [&] { return position->getPositionSensorMeasure(0, value, stamp); }) && ok;
+        }
+        if (!ok)
+        {
+            std::fprintf(stderr, "%s: a getter failed after %zu iterations\n", cfg.name.c_str(), done);
+            break;
+        }
+    }
+    double   seconds          = std::chrono::duration<double>(steadyClock::now() - start).count();
+    uint64_t totalAllocations = allocations.load(std::memory_order_relaxed) - before;
+
+    report(cfg, resolution, done, seconds, totalAllocations, getters);
+    driver.close();
+    return done == iterations;
+}
+}
+
+void* operator new(std::size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1))
+    {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+int main(int argc, char* argv[])
+{
+    yarp::os::Network yarp;
+
+    yarp::os::Property args;
+    args.fromCommand(argc, argv);
+    if (args.check("help"))
+    {
+        std::printf("Usage: %s --playbackFile <recording.bag> [--device realsense2withIMU] [--iterations 300]\n"
+                    "       [--framerate 30] [--resolutions \"((640 480) (848 480))\"]\n"
+                    "The resolutions must be part of the recording, each configuration is run for each of them.\n",
+                    argv[0]);
+        return EXIT_SUCCESS;
+    }
+
+    std::vector<std::string> resolutions;
+    if (args.check("resolutions") && args.find("resolutions").isList())
+    {
+        yarp::os::Bottle* list = args.find("resolutions").asList();
+        for (size_t i = 0; i < list->size(); i++)
+        {
+            resolutions.push_back("(" + list->get(i).toString() + ")");
+        }
+    }
+    if (resolutions.empty())
+    {
+        resolutions.emplace_back("(640 480)");
+    }
+
+    const std::vector<configuration> configurations = {
+        {"baseline", "", "(alignmentFrame None)"},
+        {"align", "", "(alignmentFrame RGB)"},
+        {"rotate", "(rotateImage 90)", "(alignmentFrame None)"},
+        {"quantize", "(QUANT_PARAM (depth_quant 2))", "(alignmentFrame None)"},
+    };
+
+    bool ok = true;
+    for (const auto& resolution : resolutions)
+    {
+        for (const auto& cfg : configurations)
+        {
+            bool hasImages = true;
+            ok = run(args, cfg, resolution, hasImages) && ok;
+            // Without images, as with realsense2Tracking, the other configurations would measure the same getters
+            if (!hasImages)
+            {
+                break;
+            }
+        }
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
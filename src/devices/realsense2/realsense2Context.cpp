@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2006-2020 Istituto Italiano di Tecnologia (IIT)
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms of the
+ * BSD-3-Clause license. See the accompanying LICENSE file for details.
+ */
+
+#include "realsense2Context.h"
+
+#include <mutex>
+#include <set>
+
+namespace {
+
+struct deviceEntry
+{
+    std::string serial;
+    bool        tracking;
+};
+
+struct registry
+{
+    rs2::context             context;
+    std::mutex               mutex;
+    std::vector<deviceEntry> devices;
+    bool                     enumerated{false};
+    std::set<std::string>    acquired;
+
+    registry()
+    {
+        // A connection or disconnection invalidates the enumeration
+        context.set_devices_changed_callback([this](rs2::event_information&)
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            enumerated = false;
+        });
+    }
+
+    // Must be called with the mutex locked
+    void enumerate()
+    {
+        if (enumerated)
+        {
+            return;
+        }
+        devices.clear();
+        for (auto&& device : context.query_devices())
+        {
+            if (!device.supports(RS2_CAMERA_INFO_SERIAL_NUMBER))
+            {
+                continue;
+            }
+            deviceEntry entry;
+            entry.serial = device.get_info(RS2_CAMERA_INFO_SERIAL_NUMBER);
+            entry.tracking = device.supports(RS2_CAMERA_INFO_PRODUCT_LINE) &&
+                             std::string(device.get_info(RS2_CAMERA_INFO_PRODUCT_LINE)) == "T200";
+            devices.push_back(entry);
+        }
+        enumerated = true;
+    }
+};
+
+registry& instance()
+{
+    // Initialized once, thread safe
+    static registry r;
+    return r;
+}
+
+} // namespace
+
+rs2::context& realsense2Context::sharedContext()
+{
+    return instance().context;
+}
+
+std::vector<std::string> realsense2Context::connectedSerials()
+{
+    registry& r = instance();
+    std::lock_guard<std::mutex> guard(r.mutex);
+    r.enumerate();
+    std::vector<std::string> serials;
+    for (const auto& entry : r.devices)
+    {
+        serials.push_back(entry.serial);
+    }
+    return serials;
+}
+
+bool realsense2Context::isConnected(const std::string& serial)
+{
+    registry& r = instance();
+    std::lock_guard<std::mutex> guard(r.mutex);
+    r.enumerate();
+    for (const auto& entry : r.devices)
+    {
+        if (entry.serial == serial)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool realsense2Context::acquireDevice(const std::string& serial, bool tracking, std::string& acquired)
+{
+    registry& r = instance();
+    std::lock_guard<std::mutex> guard(r.mutex);
+    // The enumeration is refreshed once if the device is not found, in case it has just been connected
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        r.enumerate();
+        for (const auto& entry : r.devices)
+        {
+            bool match = serial.empty() ? entry.tracking == tracking : entry.serial == serial;
+            if (match && r.acquired.count(entry.serial) == 0)
+            {
+                r.acquired.insert(entry.serial);
+                acquired = entry.serial;
+                return true;
+            }
+        }
+        r.enumerated = false;
+    }
+    return false;
+}
+
+void realsense2Context::releaseDevice(const std::string& serial)
+{
+    if (serial.empty())
+    {
+        return;
+    }
+    registry& r = instance();
+    std::lock_guard<std::mutex> guard(r.mutex);
+    r.acquired.erase(serial);
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2006-2020 Istituto Italiano di Tecnologia (IIT)
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms of the
+ * BSD-3-Clause license. See the accompanying LICENSE file for details.
+ */
+
+#ifndef REALSENSE2_CONTEXT_H
+#define REALSENSE2_CONTEXT_H
+
+#include <string>
+#include <vector>
+#include <librealsense2/rs.hpp>
+
+/**
+ * librealsense context and device enumeration shared by all the device instances of the process.
+ * The devices are enumerated once and again only after a connection or disconnection, and every
+ * device is acquired by one instance at a time, so that instances opened in parallel never
+ * compete for the same camera.
+ */
+namespace realsense2Context {
+
+/**
+ * Returns the process-wide context, the pipelines must be created on it.
+ */
+rs2::context& sharedContext();
+
+/**
+ * Returns the serial numbers of the connected devices.
+ */
+std::vector<std::string> connectedSerials();
+
+/**
+ * Returns true if the device with the given serial number is connected. The enumeration is cached,
+ * so that it can be polled, e.g. while waiting for a disconnected device.
+ */
+bool isConnected(const std::string& serial);
+
+/**
+ * Acquires a device for the calling instance.
+ * If `serial` is empty the first connected device not acquired yet is chosen, among the tracking
+ * (T2xx) devices if `tracking` is true and the other ones otherwise.
+ * @return false if the requested device is not connected or already acquired, or no device is available.
+ */
+bool acquireDevice(const std::string& serial, bool tracking, std::string& acquired);
+
+/**
+ * Releases a device acquired with acquireDevice(), it does nothing if `serial` is empty.
+ */
+void releaseDevice(const std::string& serial);
+
+} // namespace realsense2Context
+
+#endif
@@ -10,10 +10,10 @@
 #include <algorithm>
 #include <iomanip>
 #include <cstdint>
+#include <chrono>
 
 #include <yarp/os/LogComponent.h>
 #include <yarp/os/Value.h>
-#include <yarp/sig/ImageUtils.h>
 
 #include <librealsense2/rsutil.h>
 #include "realsense2Driver.h"
@@ -34,6 +34,8 @@ constexpr char clipPlanes     [] = "clipPlanes";
 constexpr char depthRes       [] = "depthResolution";
 constexpr char rgbRes         [] = "rgbResolution";
 constexpr char framerate      [] = "framerate";
+constexpr char rgbFramerate   [] = "rgbFramerate";
+constexpr char depthFramerate [] = "depthFramerate";
 constexpr char enableEmitter  [] = "enableEmitter";
 constexpr char needAlignment  [] = "needAlignment";
 constexpr char alignmentFrame [] = "alignmentFrame";
@@ -46,11 +48,21 @@ static std::map<std::string, RGBDSensorParamParser::RGBDParam> params_map =
     {depthRes,       RGBDSensorParamParser::RGBDParam(depthRes,        2)},
     {rgbRes,         RGBDSensorParamParser::RGBDParam(rgbRes,          2)},
     {framerate,      RGBDSensorParamParser::RGBDParam(framerate,       1)},
+    {rgbFramerate,   RGBDSensorParamParser::RGBDParam(rgbFramerate,    1)},
+    {depthFramerate, RGBDSensorParamParser::RGBDParam(depthFramerate,  1)},
     {enableEmitter,  RGBDSensorParamParser::RGBDParam(enableEmitter,   1)},
     {needAlignment,  RGBDSensorParamParser::RGBDParam(needAlignment,   1)},
     {alignmentFrame, RGBDSensorParamParser::RGBDParam(alignmentFrame,  1)}
 };
 
+// The acquisition thread blocks on the pipeline, the period only bounds the loop rate
+constexpr double       acquisitionPeriod      = 0.001;
+constexpr unsigned int acquisitionTimeoutMs   = 1000;
+constexpr auto         firstFramesetTimeout   = std::chrono::seconds(5);
+constexpr auto         watchdogPeriod         = std::chrono::milliseconds(50);
+// The waits for frames are split in slices, so that the restarts and the watchdog can interrupt them
+constexpr unsigned int waitSliceMs            = 50;
+
 static const std::map<std::string, rs2_stream> stringRSStreamMap {
     {"None",  RS2_STREAM_ANY},
     {"RGB",  RS2_STREAM_COLOR},
@@ -118,177 +130,6 @@ static void print_supported_options(const rs2::sensor& sensor)
     std::cout<<std::endl;
 }
 
-static bool isSupportedFormat(const rs2::sensor &sensor, const int width, const int height, const int fps, bool verbose = false)
-{
-    bool ret = false;
-    std::vector<rs2::stream_profile> stream_profiles = sensor.get_stream_profiles();
-
-    std::map<std::pair<rs2_stream, int>, int> unique_streams;
-    for (auto&& sp : stream_profiles)
-    {
-        unique_streams[std::make_pair(sp.stream_type(), sp.stream_index())]++;
-    }
-
-    if (verbose)
-    {
-        std::cout << "Sensor consists of " << unique_streams.size() << " streams: " << std::endl;
-        for (size_t i = 0; i < unique_streams.size(); i++)
-        {
-            auto it = unique_streams.begin();
-            std::advance(it, i);
-            std::cout << "  - " << it->first.first << " #" << it->first.second << std::endl;
-        }
-        std::cout << "Sensor provides the following stream profiles:" << std::endl;
-    }
-
-    //Next, we go over all the stream profiles and print the details of each one
-
-    int profile_num = 0;
-    for (const rs2::stream_profile& stream_profile : stream_profiles)
-    {
-        if (verbose)
-        {
-            rs2_stream stream_data_type = stream_profile.stream_type();
-
-            int stream_index = stream_profile.stream_index();
-
-            std::cout << std::setw(3) << profile_num << ": " << stream_data_type << " #" << stream_index;
-        }
-
-        // As noted, a stream is an abstraction.
-        // In order to get additional data for the specific type of a
-        //  stream, a mechanism of "Is" and "As" is provided:
-        if (stream_profile.is<rs2::video_stream_profile>()) //"Is" will test if the type tested is of the type given
-        {
-            // "As" will try to convert the instance to the given type
-            rs2::video_stream_profile video_stream_profile = stream_profile.as<rs2::video_stream_profile>();
-
-            // After using the "as" method we can use the new data type
-            //  for additinal operations:
-            if (verbose)
-            {
-                std::cout << " (Video Stream: " << video_stream_profile.format() << " " <<
-                video_stream_profile.width() << "x" << video_stream_profile.height() << "@ " << video_stream_profile.fps() << "Hz)";
-                std::cout << std::endl;
-            }
-
-            if(video_stream_profile.width() == width && video_stream_profile.height() == height && video_stream_profile.fps() == fps)
-                ret=true;
-        }
-        profile_num++;
-    }
-
-
-    return ret;
-}
-
-static bool optionPerc2Value(rs2_option option,const rs2::sensor* sensor, const float& perc, float& value)
-{
-    if (!sensor)
-    {
-        return false;
-    }
-    try
-    {
-        rs2::option_range optionRange = sensor->get_option_range(option);
-        value =(float) (perc * (optionRange.max - optionRange.min) + optionRange.min);
-
-    }
-    catch (const rs2::error& e)
-    {
-        // Some options can only be set while the camera is streaming,
-        // and generally the hardware might fail so it is good practice to catch exceptions from set_option
-        yCError(REALSENSE2) << "Failed to get option " << option << " range. (" << e.what() << ")";
-        return false;
-    }
-
-    return true;
-}
-
-static bool optionValue2Perc(rs2_option option,const rs2::sensor* sensor, float& perc, const float& value)
-{
-    if (!sensor)
-    {
-        return false;
-    }
-    try
-    {
-        rs2::option_range optionRange = sensor->get_option_range(option);
-        perc =(float) ((value - optionRange.min) /  (optionRange.max - optionRange.min));
-
-    }
-    catch (const rs2::error& e)
-    {
-        // Some options can only be set while the camera is streaming,
-        // and generally the hardware might fail so it is good practice to catch exceptions from set_option
-        yCError(REALSENSE2) << "Failed to get option " << option << " range. (" << e.what() << ")";
-        return false;
-    }
-
-    return true;
-}
-
-
-
-static bool setOption(rs2_option option,const rs2::sensor* sensor, float value)
-{
-
-    if (!sensor)
-    {
-        return false;
-    }
-
-    // First, verify that the sensor actually supports this option
-    if (!sensor->supports(option))
-    {
-        yCError(REALSENSE2) << "The option" << rs2_option_to_string(option) << "is not supported by this sensor";
-        return false;
-    }
-
-    // To set an option to a different value, we can call set_option with a new value
-    try
-    {
-        sensor->set_option(option, value);
-    }
-    catch (const rs2::error& e)
-    {
-        // Some options can only be set while the camera is streaming,
-        // and generally the hardware might fail so it is good practice to catch exceptions from set_option
-        yCError(REALSENSE2) << "Failed to set option " << rs2_option_to_string(option) << ". (" << e.what() << ")";
-        return false;
-    }
-    return true;
-}
-
-static bool getOption(rs2_option option,const rs2::sensor *sensor, float &value)
-{
-    if (!sensor)
-    {
-        return false;
-    }
-
-    // First, verify that the sensor actually supports this option
-    if (!sensor->supports(option))
-    {
-        yCError(REALSENSE2) << "The option" << rs2_option_to_string(option) << "is not supported by this sensor";
-        return false;
-    }
-
-    // To set an option to a different value, we can call set_option with a new value
-    try
-    {
-        value = sensor->get_option(option);
-    }
-    catch (const rs2::error& e)
-    {
-        // Some options can only be set while the camera is streaming,
-        // and generally the hardware might fail so it is good practice to catch exceptions from set_option
-        yCError(REALSENSE2) << "Failed to get option " << rs2_option_to_string(option) << ". (" << e.what() << ")";
-        return false;
-    }
-    return true;
-}
-
 static int pixFormatToCode(const rs2_format p)
 {
     switch(p)
@@ -322,6 +163,9 @@ static int pixFormatToCode(const rs2_format p)
 
     case (RS2_FORMAT_RAW8):
         return VOCAB_PIXEL_MONO;
+
+    case (RS2_FORMAT_YUYV):
+        return VOCAB_PIXEL_YUV_422;
     default:
         return VOCAB_PIXEL_INVALID;
 
@@ -341,6 +185,7 @@ static size_t bytesPerPixel(const rs2_format format)
     case RS2_FORMAT_DISPARITY16:
     case RS2_FORMAT_Y16:
     case RS2_FORMAT_RAW16:
+    case RS2_FORMAT_YUYV:
         bytes_per_pixel = 2;
         break;
     case RS2_FORMAT_RGB8:
@@ -379,6 +224,30 @@ static YarpDistortion rsDistToYarpDist(const rs2_distortion dist, const rs2_intr
     }
 }
 
+static bool sameIntrinsics(const rs2_intrinsics& a, const rs2_intrinsics& b)
+{
+    return a.width == b.width && a.height == b.height &&
+           a.fx == b.fx && a.fy == b.fy && a.ppx == b.ppx && a.ppy == b.ppy &&
+           a.model == b.model && std::equal(std::begin(a.coeffs), std::end(a.coeffs), std::begin(b.coeffs));
+}
+
+static rs2_intrinsics decimateIntrinsics(const rs2_intrinsics& values, int magnitude)
+{
+    // Same output of rs2::decimation_filter: the size divided by the magnitude and padded to a multiple of 4
+    if (magnitude <= 1)
+    {
+        return values;
+    }
+    rs2_intrinsics decimated = values;
+    decimated.width  = (values.width / magnitude + 3) / 4 * 4;
+    decimated.height = (values.height / magnitude + 3) / 4 * 4;
+    decimated.fx     = values.fx / magnitude;
+    decimated.fy     = values.fy / magnitude;
+    decimated.ppx    = values.ppx / magnitude;
+    decimated.ppy    = values.ppy / magnitude;
+    return decimated;
+}
+
 static void settingErrorMsg(const string& error, bool& ret)
 {
     yCError(REALSENSE2) << error.c_str();
@@ -429,10 +298,89 @@ static bool setExtrinsicParam(Matrix &extrinsic, const rs2_extrinsics &values)
     return false;
 }
 
-realsense2Driver::realsense2Driver() : m_depth_sensor(nullptr), m_color_sensor(nullptr),
+static rs2_intrinsics rotateIntrinsics(const rs2_intrinsics& values, int rotation)
+{
+    // Pinhole and tangential coefficients seen by a camera rotated clockwise about its optical axis.
+    // librealsense puts the pixel centers at integer coordinates, so column u moves to width - 1 - u.
+    rs2_intrinsics rotated = values;
+    switch (rotation)
+    {
+    case 90:
+        rotated.width     = values.height;
+        rotated.height    = values.width;
+        rotated.fx        = values.fy;
+        rotated.fy        = values.fx;
+        rotated.ppx       = values.height - 1 - values.ppy;
+        rotated.ppy       = values.ppx;
+        rotated.coeffs[2] = values.coeffs[3];
+        rotated.coeffs[3] = -values.coeffs[2];
+        break;
+    case 180:
+        rotated.ppx       = values.width - 1 - values.ppx;
+        rotated.ppy       = values.height - 1 - values.ppy;
+        rotated.coeffs[2] = -values.coeffs[2];
+        rotated.coeffs[3] = -values.coeffs[3];
+        break;
+    case 270:
+        rotated.width     = values.height;
+        rotated.height    = values.width;
+        rotated.fx        = values.fy;
+        rotated.fy        = values.fx;
+        rotated.ppx       = values.ppy;
+        rotated.ppy       = values.width - 1 - values.ppx;
+        rotated.coeffs[2] = -values.coeffs[3];
+        rotated.coeffs[3] = values.coeffs[2];
+        break;
+    default:
+        break;
+    }
+    return rotated;
+}
+
+static rs2_extrinsics rotateExtrinsics(const rs2_extrinsics& values, int rotation)
+{
+    // Both cameras are rotated by Rz: R' = Rz * R * Rz^T, t' = Rz * t (rotation is column-major)
+    float c = 1.0f;
+    float s = 0.0f;
+    switch (rotation)
+    {
+    case 90:  c = 0.0f;  s = 1.0f;  break;
+    case 180: c = -1.0f; s = 0.0f;  break;
+    case 270: c = 0.0f;  s = -1.0f; break;
+    default:  return values;
+    }
+    const float rz[3][3] = {{c, -s, 0.0f}, {s, c, 0.0f}, {0.0f, 0.0f, 1.0f}};
+
+    rs2_extrinsics rotated;
+    for (size_t i = 0; i < 3; i++)
+    {
+        rotated.translation[i] = 0.0f;
+        for (size_t k = 0; k < 3; k++)
+        {
+            rotated.translation[i] += rz[i][k] * values.translation[k];
+        }
+        for (size_t j = 0; j < 3; j++)
+        {
+            float sum = 0.0f;
+            for (size_t k = 0; k < 3; k++)
+            {
+                for (size_t l = 0; l < 3; l++)
+                {
+                    sum += rz[i][k] * values.rotation[l * 3 + k] * rz[j][l];
+                }
+            }
+            rotated.rotation[j * 3 + i] = sum;
+        }
+    }
+    return rotated;
+}
+
+realsense2Driver::realsense2Driver() : PeriodicThread(acquisitionPeriod),
+                                       m_pipeline(realsense2Context::sharedContext()),
+                                       m_depth_sensor(nullptr), m_color_sensor(nullptr),
                                        m_paramParser(), m_verbose(false),
                                        m_initialized(false), m_stereoMode(false),
-                                       m_needAlignment(true), m_fps(0),
+                                       m_needAlignment(true),
                                        m_scale(0.0)
 {
     // realsense SDK already provides them
@@ -440,6 +388,17 @@ realsense2Driver::realsense2Driver() : m_depth_sensor(nullptr), m_color_sensor(n
     m_paramParser.rgbIntrinsic.isOptional   = true;
     m_paramParser.isOptionalExtrinsic       = true;
 
+    // Composes the latest frame of every stream into a single frameset, see composeFrameset()
+    m_frameComposer.reset(new rs2::filter([this](rs2::frame, rs2::frame_source& source)
+    {
+        std::vector<rs2::frame> frames;
+        frames.reserve(m_latestFrames.size());
+        for (const auto& latest : m_latestFrames)
+        {
+            frames.push_back(latest.second);
+        }
+        source.frame_ready(source.allocate_composite_frame(frames));
+    }));
 
     m_supportedFeatures.push_back(YARP_FEATURE_EXPOSURE);
     m_supportedFeatures.push_back(YARP_FEATURE_WHITE_BALANCE);
@@ -454,7 +413,14 @@ bool realsense2Driver::pipelineStartup()
 {
     try
     {
-        m_profile = m_pipeline.start(m_cfg);
+        if (m_frameQueue)
+        {
+            m_profile = m_pipeline.start(m_cfg, *m_frameQueue);
+        }
+        else
+        {
+            m_profile = m_pipeline.start(m_cfg);
+        }
     }
     catch (const rs2::error& e)
     {
@@ -482,148 +448,1251 @@ bool realsense2Driver::pipelineShutdown()
 
 bool realsense2Driver::pipelineRestart()
 {
-    std::lock_guard<std::mutex> guard(m_mutex);
+    // Called with the device mutex locked
+    auto acquisitionGuard = interruptAcquisition();
     if (!pipelineShutdown())
         return false;
 
+    // Framesets acquired with the old configuration must not be delivered
+    discardFrames();
     return pipelineStartup();
 
 }
 
-bool realsense2Driver::setFramerate(const int _fps)
+std::unique_lock<std::mutex> realsense2Driver::interruptAcquisition()
 {
-    if (m_color_sensor && isSupportedFormat(*m_color_sensor,m_color_intrin.width, m_color_intrin.height, _fps, m_verbose) &&
-        m_depth_sensor && isSupportedFormat(*m_depth_sensor,m_depth_intrin.width, m_depth_intrin.height, _fps, m_verbose)) {
+    // The wait in progress gives up at the end of its slice, instead of blocking the restart until its timeout
+    m_abortWaits = true;
+    std::unique_lock<std::mutex> guard(m_acquisitionMutex);
+    m_abortWaits = false;
+    return guard;
+}
 
-        m_cfg.enable_stream(RS2_STREAM_COLOR, m_color_intrin.width, m_color_intrin.height, RS2_FORMAT_RGB8, _fps);
-        m_cfg.enable_stream(RS2_STREAM_DEPTH, m_depth_intrin.width, m_depth_intrin.height, RS2_FORMAT_Z16, _fps);
+void realsense2Driver::discardFrames()
+{
+    {
+        std::lock_guard<std::mutex> frameGuard(m_frameMutex);
+        m_latestFrameset = rs2::frameset();
+        m_hasLatestFrameset = false;
+        m_latestFrames.clear();
     }
-    else
+    if (m_frameQueue)
     {
-        if (m_initialized)
-        {
-            fallback();
-        }
-
+        rs2::frame stale;
+        while (m_frameQueue->poll_for_frame(&stale)) {}
     }
-
-    if (!pipelineRestart())
-        return false;
-
-    m_fps = _fps;
-
-    updateTransformations();
-
-    return true;
-
+    m_lastDepthFrameNumber = 0;
 }
 
-void realsense2Driver::fallback()
+bool realsense2Driver::isStalled() const
 {
-    m_cfg.enable_stream(RS2_STREAM_COLOR, m_color_intrin.width, m_color_intrin.height, RS2_FORMAT_RGB8, m_fps);
-    m_cfg.enable_stream(RS2_STREAM_DEPTH, m_depth_intrin.width, m_depth_intrin.height, RS2_FORMAT_Z16, m_fps);
-    yCWarning(REALSENSE2)<<"Format not supported, use --verbose for more details. Setting the fallback format";
-    std::cout<<"COLOR: "<<m_color_intrin.width<<"x"<<m_color_intrin.height<<" fps: "<<m_fps<<std::endl;
-    std::cout<<"DEPTH: "<<m_depth_intrin.width<<"x"<<m_depth_intrin.height<<" fps: "<<m_fps<<std::endl;
+    if (!realsense2Context::isConnected(m_acquiredSerial))
+    {
+        return true;
+    }
+    long long start = m_waitStart;
+    auto waited = std::chrono::steady_clock::now().time_since_epoch() - std::chrono::steady_clock::duration(start);
+    return start != 0 && std::chrono::duration<double>(waited).count() > m_watchdogTimeout;
 }
 
-bool realsense2Driver::initializeRealsenseDevice()
+void realsense2Driver::watchdogLoop()
 {
-    if (!params_map[rgbRes].isSetting || !params_map[depthRes].isSetting)
+    std::unique_lock<std::mutex> lock(m_watchdogMutex);
+    while (!m_watchdogCondition.wait_for(lock, watchdogPeriod, [this] { return m_watchdogStop; }))
     {
-        yCError(REALSENSE2)<<"Missing depthResolution or rgbResolution from [SETTINGS]";
-        return false;
-    }
-    double colorW = params_map[rgbRes].val[0].asFloat64();
-    double colorH = params_map[rgbRes].val[1].asFloat64();
-    double depthW = params_map[depthRes].val[0].asFloat64();
-    double depthH = params_map[depthRes].val[1].asFloat64();
-
-    m_cfg.enable_stream(RS2_STREAM_COLOR, colorW, colorH, RS2_FORMAT_RGB8, m_fps);
-    m_cfg.enable_stream(RS2_STREAM_DEPTH, depthW, depthH, RS2_FORMAT_Z16, m_fps);
-    if (m_stereoMode) {
-        m_cfg.enable_stream(RS2_STREAM_INFRARED, 1, colorW, colorH, RS2_FORMAT_Y8, m_fps);
-        m_cfg.enable_stream(RS2_STREAM_INFRARED, 2, colorW, colorH, RS2_FORMAT_Y8, m_fps);
-    }
-    if (!pipelineStartup())
-        return false;
-    m_initialized = true;
+        if (!m_reconnecting)
+        {
+            if (!isStalled())
+            {
+                continue;
+            }
+            yCWarning(REALSENSE2) << "The device" << m_acquiredSerial << "stopped streaming, reconnecting...";
+            {
+                // The getters waiting for frames give up at once
+                std::lock_guard<std::mutex> frameGuard(m_frameMutex);
+                m_reconnecting = true;
+            }
+            m_frameCondition.notify_all();
+        }
 
-    // Camera warmup - Dropped frames to allow stabilization
-    yCInfo(REALSENSE2) << "Sensor warm-up...";
-    for (int i = 0; i < 30; i++)
-    {
-        try
+        // The device mutex is not held while waiting, so that the getters fail fast instead of blocking
+        if (!realsense2Context::isConnected(m_acquiredSerial))
         {
-            m_pipeline.wait_for_frames();
+            continue;
         }
-        catch (const rs2::error& e)
+        lock.unlock();
+        bool reconnected = reconnectDevice();
+        lock.lock();
+        if (reconnected)
         {
-            yCError(REALSENSE2) << "m_pipeline.wait_for_frames() failed with error:"<< "(" << e.what() << ")";
-            m_lastError = e.what();
+            yCInfo(REALSENSE2) << "The device" << m_acquiredSerial << "is streaming again";
+            m_reconnecting = false;
         }
     }
-    yCInfo(REALSENSE2) << "Device ready!";
+}
 
-    if (m_ctx.query_devices().size() == 0)
+bool realsense2Driver::reconnectDevice()
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    auto acquisitionGuard = interruptAcquisition();
+    try
     {
-        yCError(REALSENSE2) << "No device connected, please connect a RealSense device";
-
-        rs2::device_hub device_hub(m_ctx);
-
-        //Using the device_hub we can block the program until a device connects
-        m_device = device_hub.wait_for_device();
+        m_pipeline.stop();
     }
-    else
+    catch (const rs2::error&)
     {
-        //TODO: if more are connected?!
-        // Update the selected device
-        m_device = m_profile.get_device();
-        if (m_verbose)
-            yCInfo(REALSENSE2) << get_device_information(m_device).c_str();
+        // Already stopped, e.g. by the disconnection
     }
+    discardFrames();
 
-
-    // Given a device, we can query its sensors using:
-    m_sensors = m_device.query_sensors();
-
-    yCInfo(REALSENSE2) << "Device consists of" << m_sensors.size() << "sensors. More infos using --verbose option";
-    if (m_verbose)
+    // Same configuration (device and streams) of open(), without the warm-up
+    if (!pipelineStartup())
     {
-        for (const auto & m_sensor : m_sensors)
-        {
-            print_supported_options(m_sensor);
-        }
+        return false;
+    }
+    rs2::device device = m_profile.get_device();
+    std::vector<rs2::sensor> sensors = device.query_sensors();
+    if (sensors.size() != m_sensors.size())
+    {
+        yCError(REALSENSE2) << "The reconnected device has a different set of sensors";
+        return false;
     }
+    m_device = device;
+    // Assigned in place, so that the sensor pointers, the option cache and the profile table stay valid
+    for (size_t i = 0; i < sensors.size(); i++)
+    {
+        m_sensors[i] = sensors[i];
+    }
+    restoreOptions();
+    deviceReconnected();
+    m_waitStart = 0;
+    return true;
+}
 
-    for (auto & m_sensor : m_sensors)
+void realsense2Driver::restoreOptions()
+{
+    // The device restarts with its default settings, set again the values known to the driver
+    std::vector<std::pair<rs2::sensor*, std::pair<rs2_option, float>>> values;
     {
-        if (m_sensor.is<rs2::depth_sensor>())
+        std::lock_guard<std::mutex> guard(m_optionMutex);
+        for (const auto& entry : m_options)
         {
-            m_depth_sensor =  &m_sensor;
-            if (!getOption(RS2_OPTION_DEPTH_UNITS, m_depth_sensor, m_scale))
+            if (entry.second.hasValue)
             {
-                yCError(REALSENSE2) << "Failed to retrieve scale";
-                return false;
+                values.emplace_back(const_cast<rs2::sensor*>(entry.first.first), std::make_pair(entry.first.second, entry.second.value));
             }
         }
-        else if (m_sensor.get_stream_profiles()[0].stream_type() == RS2_STREAM_COLOR)
-            m_color_sensor = &m_sensor;
     }
-
-    // Get stream intrinsics & extrinsics
-    updateTransformations();
+    for (const auto& value : values)
+    {
+        if (isAutoControlled(value.second.first, value.first))
+        {
+            continue;
+        }
+        try
+        {
+            value.first->set_option(value.second.first, value.second.second);
+        }
+        catch (const rs2::error& e)
+        {
+            yCWarning(REALSENSE2) << "Failed to restore option" << rs2_option_to_string(value.second.first) << "(" << e.what() << ")";
+        }
+    }
+}
+
+std::unique_lock<std::mutex> realsense2Driver::acquireFrameset(unsigned int streams, rs2::frameset& data)
+{
+    // The device mutex is not held while waiting for the frameset, so that the other getters, the
+    // controls and the watchdog are not blocked meanwhile
+    {
+        auto guard = lockDevice();
+        if (!requestStreams(streams))
+        {
+            return std::unique_lock<std::mutex>();
+        }
+    }
+    unsigned long long sequence = 0;
+    if (!getFrameset(data, sequence))
+    {
+        return std::unique_lock<std::mutex>();
+    }
+    auto guard = lockDevice();
+    m_deliveredSequence = sequence;
+    m_consumer = std::this_thread::get_id();
+    updateDepthGeometry(data);
+    return guard;
+}
+
+bool realsense2Driver::getFrameset(rs2::frameset& data, unsigned long long& sequence) const
+{
+    if (m_asyncAcquisition)
+    {
+        // Only the first frameset is waited for, afterwards every consumer receives the newest one at once
+        auto start = m_statistics.now();
+        std::unique_lock<std::mutex> lock(m_frameMutex);
+        if (!m_frameCondition.wait_for(lock, firstFramesetTimeout, [this] { return m_hasLatestFrameset || m_reconnecting; }) ||
+            !m_hasLatestFrameset)
+        {
+            yCError(REALSENSE2) << "No frameset received from the acquisition thread";
+            m_lastError = "No frameset received from the acquisition thread";
+            return false;
+        }
+        data = m_latestFrameset;
+        sequence = m_latestSequence;
+        lock.unlock();
+        m_statistics.record(realsense2Stage::wait, start);
+        reportStatistics();
+        return true;
+    }
+
+    for (;;)
+    {
+        if (m_reconnecting)
+        {
+            yCError(REALSENSE2) << "The device is reconnecting";
+            m_lastError = "The device is reconnecting";
+            return false;
+        }
+        unsigned long long seen;
+        {
+            std::lock_guard<std::mutex> frameGuard(m_frameMutex);
+            seen = m_latestSequence;
+        }
+        std::lock_guard<std::mutex> acquisitionGuard(m_acquisitionMutex);
+        {
+            // Acquired by another consumer while this one was waiting for its turn: the same frameset is shared
+            std::lock_guard<std::mutex> frameGuard(m_frameMutex);
+            if (m_hasLatestFrameset && m_latestSequence != seen)
+            {
+                data = m_latestFrameset;
+                sequence = m_latestSequence;
+                return true;
+            }
+        }
+
+        bool interrupted = false;
+        try
+        {
+            bool complete = false;
+            while (!complete)
+            {
+                auto start = m_statistics.now();
+                // With the watchdog the getters fail as soon as the device is considered stalled
+                unsigned int timeoutMs = m_watchdogTimeout > 0.0 ? static_cast<unsigned int>(m_watchdogTimeout * 1000) : RS2_DEFAULT_TIMEOUT;
+                if (!waitForFrameset(data, timeoutMs))
+                {
+                    // Interrupted by a restart of the pipeline: wait again once it is streaming
+                    interrupted = m_abortWaits && !m_reconnecting;
+                    if (interrupted)
+                    {
+                        break;
+                    }
+                    yCError(REALSENSE2) << "Timeout waiting for frames";
+                    m_lastError = "Timeout waiting for frames";
+                    return false;
+                }
+                m_statistics.record(realsense2Stage::wait, start);
+                filterFrameset(data);
+                std::lock_guard<std::mutex> frameGuard(m_frameMutex);
+                complete = composeFrameset(data);
+                if (complete)
+                {
+                    m_latestFrameset = data;
+                    m_hasLatestFrameset = true;
+                    sequence = ++m_latestSequence;
+                }
+            }
+            if (!interrupted)
+            {
+                reportSyncFrame(data);
+            }
+        }
+        catch (const rs2::error& e)
+        {
+            yCError(REALSENSE2) << "m_pipeline.wait_for_frames() failed with error:"<< "(" << e.what() << ")";
+            m_lastError = e.what();
+            return false;
+        }
+        if (!interrupted)
+        {
+            reportStatistics();
+            return true;
+        }
+    }
+}
+
+bool realsense2Driver::waitForFrameset(rs2::frameset& data, unsigned int timeoutMs) const
+{
+    if (m_watchdogTimeout > 0.0 && m_waitStart == 0)
+    {
+        m_waitStart = static_cast<long long>(std::chrono::steady_clock::now().time_since_epoch().count());
+    }
+    rs2::frame frame;
+    bool received = false;
+    for (unsigned int waited = 0; !received && waited < timeoutMs; waited += waitSliceMs)
+    {
+        if (m_abortWaits || m_reconnecting)
+        {
+            return false;
+        }
+        unsigned int slice = std::min(waitSliceMs, timeoutMs - waited);
+        received = m_frameQueue ? m_frameQueue->try_wait_for_frame(&frame, slice) : m_pipeline.try_wait_for_frames(&data, slice);
+    }
+    if (!received)
+    {
+        return false;
+    }
+    if (m_frameQueue)
+    {
+        if (m_framePolicy == latest_frame)
+        {
+            // Low latency: skip the framesets queued while the consumer was busy
+            rs2::frame newer;
+            while (m_frameQueue->poll_for_frame(&newer))
+            {
+                frame = newer;
+            }
+        }
+        data = frame;
+    }
+
+    m_waitStart = 0;
+
+    if (m_statistics.enabled())
+    {
+        if (data.first_or_default(RS2_STREAM_COLOR))
+            m_statistics.countFrame(realsense2StatisticsStream::color);
+        if (data.first_or_default(RS2_STREAM_INFRARED))
+            m_statistics.countFrame(realsense2StatisticsStream::infrared);
+    }
+
+    // The gaps between the delivered depth frames count both the policy drops and the queue overflows
+    rs2::frame depth = data.first_or_default(RS2_STREAM_DEPTH);
+    if (depth)
+    {
+        m_statistics.countFrame(realsense2StatisticsStream::depth);
+        unsigned long long number = depth.get_frame_number();
+        if (m_lastDepthFrameNumber != 0 && number > m_lastDepthFrameNumber + 1)
+        {
+            m_droppedFrames += number - m_lastDepthFrameNumber - 1;
+        }
+        m_lastDepthFrameNumber = number;
+    }
+    return true;
+}
+
+unsigned long long realsense2Driver::getDroppedFrames() const
+{
+    return m_droppedFrames;
+}
+
+std::vector<realsense2StageStatistics> realsense2Driver::getStageStatistics(std::vector<double>& framerates) const
+{
+    return m_statistics.summary(framerates, false);
+}
+
+void realsense2Driver::reportStatistics() const
+{
+    if (!m_statistics.reportDue(m_statisticsPeriod))
+    {
+        return;
+    }
+    std::vector<double> framerates;
+    auto stages = m_statistics.summary(framerates, true);
+    yCInfo(REALSENSE2) << "Rates (fps): color" << framerates[static_cast<size_t>(realsense2StatisticsStream::color)]
+                       << "depth" << framerates[static_cast<size_t>(realsense2StatisticsStream::depth)]
+                       << "infrared" << framerates[static_cast<size_t>(realsense2StatisticsStream::infrared)]
+                       << "- dropped depth frames:" << getDroppedFrames()
+                       << "- active streams:" << activeStreamsDescription();
+    for (const auto& stage : stages)
+    {
+        if (stage.samples == 0)
+        {
+            continue;
+        }
+        yCInfo(REALSENSE2) << "Stage" << stage.name << "(us): samples" << stage.samples << "mean" << stage.mean
+                           << "p50 <=" << stage.p50 << "p99 <=" << stage.p99 << "max" << stage.max;
+    }
+}
+
+std::unique_lock<std::mutex> realsense2Driver::lockDevice() const
+{
+    auto start = m_statistics.now();
+    std::unique_lock<std::mutex> guard(m_mutex);
+    m_statistics.record(realsense2Stage::lockWait, start);
+    return guard;
+}
+
+bool realsense2Driver::composeFrameset(rs2::frameset& data) const
+{
+    if (!m_independentStreams)
+    {
+        return true;
+    }
+
+    // With different framerates the pipeline delivers partial framesets: keep the latest
+    // frame of each stream and deliver them together.
+    data.foreach_rs([this](rs2::frame frame)
+    {
+        m_latestFrames[frame.get_profile().unique_id()] = frame;
+    });
+
+    bool hasColor = false;
+    bool hasDepth = false;
+    for (const auto& latest : m_latestFrames)
+    {
+        rs2_stream stream = latest.second.get_profile().stream_type();
+        hasColor |= stream == RS2_STREAM_COLOR;
+        hasDepth |= stream == RS2_STREAM_DEPTH;
+    }
+    // Paused lazy streams are not waited for
+    const unsigned int active = m_lazyStreams ? m_activeStreams.load() : m_requestedStreams;
+    if ((!hasColor && (active & color_stream)) || (!hasDepth && (active & depth_stream)))
+    {
+        return false;
+    }
+
+    data = m_frameComposer->process(data);
+    return true;
+}
+
+void realsense2Driver::updateStamp(Stamp& stamp, const rs2::frame& frame) const
+{
+    if (m_timestamp_type == rs_timestamp)
+    {
+        // librealsense timestamps are in milliseconds, the frame number reveals dropped or repeated frames
+        stamp = Stamp(static_cast<int>(frame.get_frame_number()), frame.get_timestamp() / 1000.0);
+    }
+    else
+    {
+        stamp.update();
+    }
+}
+
+void realsense2Driver::reportSyncFrame(const rs2::frameset& data) const
+{
+    if (!m_syncGroup)
+    {
+        return;
+    }
+    rs2::depth_frame depth = data.get_depth_frame();
+    // With independent framerates the same depth frame can be delivered in several framesets
+    if (!depth || depth.get_frame_number() == m_lastSyncFrameNumber)
+    {
+        return;
+    }
+    m_lastSyncFrameNumber = depth.get_frame_number();
+    m_syncGroup->report(m_acquiredSerial, depth);
+}
+
+bool realsense2Driver::getMatchedSyncSet(std::map<std::string, realsense2SyncFrame>& set) const
+{
+    if (!m_syncGroup)
+    {
+        return false;
+    }
+    return m_syncGroup->getMatchedSet(set);
+}
+
+bool realsense2Driver::getSyncStatistics(std::map<std::string, realsense2SyncStatistics>& statistics) const
+{
+    if (!m_syncGroup)
+    {
+        return false;
+    }
+    statistics = m_syncGroup->getStatistics();
+    return true;
+}
+
+void realsense2Driver::filterFrameset(rs2::frameset& data) const
+{
+    if (m_depthFilters.empty())
+    {
+        return;
+    }
+    auto start = m_statistics.now();
+    // The filters only modify the depth frame, the other frames of the set are forwarded as they are
+    for (const auto& filter : m_depthFilters)
+    {
+        data = filter->process(data);
+    }
+    m_statistics.record(realsense2Stage::postProcess, start);
+}
+
+bool realsense2Driver::setupPostProcessing(const yarp::os::Searchable& cfg)
+{
+    m_depthFilters.clear();
+    m_depthDecimation = 1;
+    try
+    {
+        // Chain order recommended by librealsense: decimation first, so that the following
+        // filters, the alignment and the conversion work on fewer pixels.
+        if (cfg.check("decimation"))
+        {
+            auto filter = std::make_shared<rs2::decimation_filter>();
+            filter->set_option(RS2_OPTION_FILTER_MAGNITUDE, cfg.find("decimation").asFloat64());
+            m_depthFilters.push_back(filter);
+            m_depthDecimation = static_cast<int>(filter->get_option(RS2_OPTION_FILTER_MAGNITUDE));
+        }
+        if (cfg.check("threshold"))
+        {
+            yarp::os::Bottle* limits = cfg.find("threshold").asList();
+            if (limits == nullptr || limits->size() != 2)
+            {
+                yCError(REALSENSE2) << "POST_PROCESSING: threshold must be a list of two values (min max)";
+                return false;
+            }
+            auto filter = std::make_shared<rs2::threshold_filter>(limits->get(0).asFloat64(), limits->get(1).asFloat64());
+            m_depthFilters.push_back(filter);
+        }
+        if (cfg.check("spatial") && cfg.find("spatial").asBool())
+        {
+            auto filter = std::make_shared<rs2::spatial_filter>();
+            if (cfg.check("spatial_magnitude"))
+                filter->set_option(RS2_OPTION_FILTER_MAGNITUDE, cfg.find("spatial_magnitude").asFloat64());
+            if (cfg.check("spatial_alpha"))
+                filter->set_option(RS2_OPTION_FILTER_SMOOTH_ALPHA, cfg.find("spatial_alpha").asFloat64());
+            if (cfg.check("spatial_delta"))
+                filter->set_option(RS2_OPTION_FILTER_SMOOTH_DELTA, cfg.find("spatial_delta").asFloat64());
+            m_depthFilters.push_back(filter);
+        }
+        if (cfg.check("temporal") && cfg.find("temporal").asBool())
+        {
+            auto filter = std::make_shared<rs2::temporal_filter>();
+            if (cfg.check("temporal_alpha"))
+                filter->set_option(RS2_OPTION_FILTER_SMOOTH_ALPHA, cfg.find("temporal_alpha").asFloat64());
+            if (cfg.check("temporal_delta"))
+                filter->set_option(RS2_OPTION_FILTER_SMOOTH_DELTA, cfg.find("temporal_delta").asFloat64());
+            m_depthFilters.push_back(filter);
+        }
+        if (cfg.check("hole_filling"))
+        {
+            auto filter = std::make_shared<rs2::hole_filling_filter>(cfg.find("hole_filling").asInt32());
+            m_depthFilters.push_back(filter);
+        }
+    }
+    catch (const rs2::error& e)
+    {
+        yCError(REALSENSE2) << "POST_PROCESSING: failed to configure the depth filters:" << "(" << e.what() << ")";
+        m_lastError = e.what();
+        m_depthFilters.clear();
+        return false;
+    }
+
+    yCInfo(REALSENSE2) << "Depth post-processing enabled with" << m_depthFilters.size() << "filters";
+    return true;
+}
+
+void realsense2Driver::run()
+{
+    if (m_reconnecting)
+    {
+        // Nothing to acquire until the watchdog restarts the pipeline
+        std::this_thread::sleep_for(watchdogPeriod);
+        return;
+    }
+    std::unique_lock<std::mutex> acquisitionGuard(m_acquisitionMutex);
+    rs2::frameset data;
+    try
+    {
+        if (!waitForFrameset(data, acquisitionTimeoutMs))
+        {
+            return;
+        }
+    }
+    catch (const rs2::error&)
+    {
+        // The pipeline may be restarting, just try again at the next iteration
+        return;
+    }
+
+    if (m_warmupPending > 0)
+    {
+        // Background warm-up: the first framesets are dropped while the auto exposure settles
+        m_warmupPending--;
+        if (m_warmupTimeout > 0 && std::chrono::steady_clock::now() > m_warmupDeadline)
+        {
+            m_warmupPending = 0;
+        }
+        if (m_warmupPending == 0)
+        {
+            yCInfo(REALSENSE2) << "Device ready!";
+        }
+        return;
+    }
+
+    unsigned long long sequence = 0;
+    try
+    {
+        filterFrameset(data);
+        std::lock_guard<std::mutex> frameGuard(m_frameMutex);
+        if (!composeFrameset(data))
+        {
+            return;
+        }
+        m_latestFrameset = data;
+        m_hasLatestFrameset = true;
+        sequence = ++m_latestSequence;
+        reportSyncFrame(data);
+    }
+    catch (const rs2::error&)
+    {
+        return;
+    }
+    acquisitionGuard.unlock();
+    m_frameCondition.notify_all();
+
+    // The compressed depth is encoded here, off the getters, unless it has to be aligned to the color first
+    if (m_depthCompression && m_alignment_stream != RS2_STREAM_COLOR)
+    {
+        auto encoded = std::make_shared<std::vector<unsigned char>>();
+        encodeDepth(data.get_depth_frame(), m_acquisitionCompressionScratch, *encoded);
+        std::lock_guard<std::mutex> frameGuard(m_frameMutex);
+        if (m_latestSequence == sequence)
+        {
+            m_latestCompressedDepth = encoded;
+            m_compressedSequence = sequence;
+        }
+    }
+}
+
+bool realsense2Driver::setFramerate(const int _fps)
+{
+    return setFramerates(_fps, _fps);
+}
+
+bool realsense2Driver::setFramerates(const int rgbFps, const int depthFps)
+{
+    streamSettings settings = m_streams;
+    settings.rgbFps   = rgbFps;
+    settings.depthFps = depthFps;
+    return applyStreamSettings(settings);
+}
+
+bool realsense2Driver::parseStreamSettings(streamSettings& settings)
+{
+    bool ret = true;
+    if (!params_map[rgbRes].isSetting || !params_map[depthRes].isSetting)
+    {
+        yCError(REALSENSE2)<<"Missing depthResolution or rgbResolution from [SETTINGS]";
+        return false;
+    }
+
+    //DEPTH_RES
+    if (!params_map[depthRes].val[0].isInt32() || !params_map[depthRes].val[1].isInt32())
+    {
+        settingErrorMsg("Param " + params_map[depthRes].name + " is not a int as it should be.", ret);
+    }
+    settings.depthWidth  = params_map[depthRes].val[0].asInt32();
+    settings.depthHeight = params_map[depthRes].val[1].asInt32();
+
+    //RGB_RES
+    if (!params_map[rgbRes].val[0].isInt32() || !params_map[rgbRes].val[1].isInt32())
+    {
+        settingErrorMsg("Param " + params_map[rgbRes].name + " is not a int as it should be.", ret);
+    }
+    settings.rgbWidth  = params_map[rgbRes].val[0].asInt32();
+    settings.rgbHeight = params_map[rgbRes].val[1].asInt32();
+
+    //FRAMERATE
+    int fps = 30;
+    if (params_map[framerate].isSetting && ret)
+    {
+        if (!params_map[framerate].val[0].isInt32() )
+            settingErrorMsg("Param " + params_map[framerate].name + " is not a int as it should be.", ret);
+        else
+            fps = params_map[framerate].val[0].asInt32();
+    }
+    else
+    {
+        yCWarning(REALSENSE2) << "Framerate not specified... setting 30 fps by default";
+    }
+    settings.rgbFps   = fps;
+    settings.depthFps = fps;
+
+    if (params_map[rgbFramerate].isSetting && ret)
+    {
+        if (!params_map[rgbFramerate].val[0].isInt32() )
+            settingErrorMsg("Param " + params_map[rgbFramerate].name + " is not a int as it should be.", ret);
+        else
+            settings.rgbFps = params_map[rgbFramerate].val[0].asInt32();
+    }
+
+    if (params_map[depthFramerate].isSetting && ret)
+    {
+        if (!params_map[depthFramerate].val[0].isInt32() )
+            settingErrorMsg("Param " + params_map[depthFramerate].name + " is not a int as it should be.", ret);
+        else
+            settings.depthFps = params_map[depthFramerate].val[0].asInt32();
+    }
+    return ret;
+}
+
+void realsense2Driver::enableStreams(const streamSettings& settings)
+{
+    // Without lazy streams all the requested streams are always active
+    const unsigned int active = m_lazyStreams ? m_activeStreams.load() : m_requestedStreams;
+    if (active & color_stream)
+        m_cfg.enable_stream(RS2_STREAM_COLOR, settings.rgbWidth, settings.rgbHeight, m_rgbFormat, settings.rgbFps);
+    else
+        m_cfg.disable_stream(RS2_STREAM_COLOR);
+    if (active & depth_stream)
+        m_cfg.enable_stream(RS2_STREAM_DEPTH, settings.depthWidth, settings.depthHeight, RS2_FORMAT_Z16, settings.depthFps);
+    else
+        m_cfg.disable_stream(RS2_STREAM_DEPTH);
+    if (active & infrared_stream) {
+        m_cfg.enable_stream(RS2_STREAM_INFRARED, 1, settings.rgbWidth, settings.rgbHeight, RS2_FORMAT_Y8, settings.depthFps);
+        if (m_infraredStreams == 2)
+            m_cfg.enable_stream(RS2_STREAM_INFRARED, 2, settings.rgbWidth, settings.rgbHeight, RS2_FORMAT_Y8, settings.depthFps);
+    } else if (m_stereoMode) {
+        m_cfg.disable_stream(RS2_STREAM_INFRARED);
+    }
+}
+
+bool realsense2Driver::requestStreams(unsigned int streams)
+{
+    // Called by the getters with the device mutex locked
+    if (!m_lazyStreams)
+    {
+        return true;
+    }
+    auto now = std::chrono::steady_clock::now();
+    auto timeout = std::chrono::duration<double>(m_lazyStreamsTimeout);
+    unsigned int previous = m_activeStreams;
+    unsigned int wanted = previous | streams;
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        unsigned int bit = 1u << i;
+        if (streams & bit)
+        {
+            m_lastRead[i] = now;
+        }
+        else if ((wanted & bit) && now - m_lastRead[i] > timeout)
+        {
+            wanted &= ~bit;
+        }
+    }
+    if (wanted == previous)
+    {
+        return true;
+    }
+
+    // Same batched reconfiguration of the stream settings: one restart for all the changed streams
+    auto acquisitionGuard = interruptAcquisition();
+    m_activeStreams = wanted;
+    enableStreams(m_streams);
+    pipelineShutdown();
+    discardFrames();
+    if (!pipelineStartup())
+    {
+        yCError(REALSENSE2) << "Failed to change the active streams, keeping" << activeStreamsDescription();
+        m_activeStreams = previous;
+        enableStreams(m_streams);
+        pipelineStartup();
+        return false;
+    }
+    yCInfo(REALSENSE2) << "Active streams:" << activeStreamsDescription();
+    return true;
+}
+
+std::string realsense2Driver::activeStreamsDescription() const
+{
+    unsigned int active = m_lazyStreams ? m_activeStreams.load() : m_requestedStreams;
+    std::string description;
+    if (active & color_stream)
+        description += " color";
+    if (active & depth_stream)
+        description += " depth";
+    if (active & infrared_stream)
+        description += " infrared";
+    return description.empty() ? "none" : description.substr(1);
+}
+
+void realsense2Driver::buildOptionCache()
+{
+    // Support flags and ranges do not change while the device is connected: query them once,
+    // so that the feature getters and setters do not go through librealsense every time.
+    std::lock_guard<std::mutex> guard(m_optionMutex);
+    m_options.clear();
+    for (const auto& sensor : m_sensors)
+    {
+        for (int i = 0; i < static_cast<int>(RS2_OPTION_COUNT); i++)
+        {
+            auto option = static_cast<rs2_option>(i);
+            optionInfo info;
+            info.supported = sensor.supports(option);
+            if (info.supported)
+            {
+                try
+                {
+                    info.range = sensor.get_option_range(option);
+                    info.hasRange = true;
+                }
+                catch (const rs2::error&)
+                {
+                    // The range will be queried on demand
+                }
+            }
+            m_options[std::make_pair(&sensor, option)] = info;
+        }
+    }
+}
+
+realsense2Driver::optionInfo* realsense2Driver::findOption(rs2_option option, const rs2::sensor* sensor)
+{
+    auto it = m_options.find(std::make_pair(sensor, option));
+    return it == m_options.end() ? nullptr : &it->second;
+}
+
+bool realsense2Driver::isAutoControlled(rs2_option option, const rs2::sensor* sensor)
+{
+    rs2_option autoOption;
+    switch (option)
+    {
+    case RS2_OPTION_EXPOSURE:
+    case RS2_OPTION_GAIN:
+        autoOption = RS2_OPTION_ENABLE_AUTO_EXPOSURE;
+        break;
+    case RS2_OPTION_WHITE_BALANCE:
+        autoOption = RS2_OPTION_ENABLE_AUTO_WHITE_BALANCE;
+        break;
+    default:
+        return false;
+    }
+    // If the state of the automatic control is not known, assume it is active
+    optionInfo* autoInfo = findOption(autoOption, sensor);
+    return autoInfo && autoInfo->supported && (!autoInfo->hasValue || autoInfo->value != 0.0f);
+}
+
+bool realsense2Driver::getOptionRange(rs2_option option, const rs2::sensor* sensor, rs2::option_range& range)
+{
+    {
+        std::lock_guard<std::mutex> guard(m_optionMutex);
+        optionInfo* info = findOption(option, sensor);
+        if (info && info->hasRange)
+        {
+            range = info->range;
+            return true;
+        }
+    }
+
+    try
+    {
+        range = sensor->get_option_range(option);
+    }
+    catch (const rs2::error& e)
+    {
+        // Some options can only be set while the camera is streaming,
+        // and generally the hardware might fail so it is good practice to catch exceptions from set_option
+        yCError(REALSENSE2) << "Failed to get option " << option << " range. (" << e.what() << ")";
+        return false;
+    }
+
+    std::lock_guard<std::mutex> guard(m_optionMutex);
+    optionInfo* info = findOption(option, sensor);
+    if (info)
+    {
+        info->range = range;
+        info->hasRange = true;
+    }
+    return true;
+}
+
+bool realsense2Driver::optionPerc2Value(rs2_option option,const rs2::sensor* sensor, const float& perc, float& value)
+{
+    if (!sensor)
+    {
+        return false;
+    }
+    rs2::option_range optionRange;
+    if (!getOptionRange(option, sensor, optionRange))
+    {
+        return false;
+    }
+    value =(float) (perc * (optionRange.max - optionRange.min) + optionRange.min);
+    return true;
+}
+
+bool realsense2Driver::optionValue2Perc(rs2_option option,const rs2::sensor* sensor, float& perc, const float& value)
+{
+    if (!sensor)
+    {
+        return false;
+    }
+    rs2::option_range optionRange;
+    if (!getOptionRange(option, sensor, optionRange))
+    {
+        return false;
+    }
+    perc =(float) ((value - optionRange.min) /  (optionRange.max - optionRange.min));
+    return true;
+}
+
+bool realsense2Driver::setOption(rs2_option option,const rs2::sensor* sensor, float value)
+{
+    if (!sensor)
+    {
+        return false;
+    }
+
+    // First, verify that the sensor actually supports this option
+    bool supported;
+    {
+        std::lock_guard<std::mutex> guard(m_optionMutex);
+        optionInfo* info = findOption(option, sensor);
+        supported = info ? info->supported : sensor->supports(option);
+    }
+    if (!supported)
+    {
+        yCError(REALSENSE2) << "The option" << rs2_option_to_string(option) << "is not supported by this sensor";
+        return false;
+    }
+
+    // To set an option to a different value, we can call set_option with a new value
+    try
+    {
+        sensor->set_option(option, value);
+    }
+    catch (const rs2::error& e)
+    {
+        // Some options can only be set while the camera is streaming,
+        // and generally the hardware might fail so it is good practice to catch exceptions from set_option
+        yCError(REALSENSE2) << "Failed to set option " << rs2_option_to_string(option) << ". (" << e.what() << ")";
+        return false;
+    }
+
+    std::lock_guard<std::mutex> guard(m_optionMutex);
+    if (option == RS2_OPTION_VISUAL_PRESET)
+    {
+        // A preset rewrites many options of the sensor
+        for (auto& entry : m_options)
+        {
+            if (entry.first.first == sensor)
+            {
+                entry.second.hasValue = false;
+            }
+        }
+    }
+    optionInfo* info = findOption(option, sensor);
+    if (info)
+    {
+        info->hasValue = true;
+        info->value = value;
+    }
+    return true;
+}
+
+bool realsense2Driver::getOption(rs2_option option,const rs2::sensor *sensor, float &value)
+{
+    if (!sensor)
+    {
+        return false;
+    }
+
+    bool supported;
+    {
+        std::lock_guard<std::mutex> guard(m_optionMutex);
+        optionInfo* info = findOption(option, sensor);
+        if (m_cacheOptionValues && info && info->hasValue && !isAutoControlled(option, sensor))
+        {
+            value = info->value;
+            return true;
+        }
+        supported = info ? info->supported : sensor->supports(option);
+    }
+
+    // First, verify that the sensor actually supports this option
+    if (!supported)
+    {
+        yCError(REALSENSE2) << "The option" << rs2_option_to_string(option) << "is not supported by this sensor";
+        return false;
+    }
+
+    try
+    {
+        value = sensor->get_option(option);
+    }
+    catch (const rs2::error& e)
+    {
+        // Some options can only be set while the camera is streaming,
+        // and generally the hardware might fail so it is good practice to catch exceptions from set_option
+        yCError(REALSENSE2) << "Failed to get option " << rs2_option_to_string(option) << ". (" << e.what() << ")";
+        return false;
+    }
+
+    std::lock_guard<std::mutex> guard(m_optionMutex);
+    optionInfo* info = findOption(option, sensor);
+    if (info)
+    {
+        info->hasValue = true;
+        info->value = value;
+    }
+    return true;
+}
+
+void realsense2Driver::buildProfileTable()
+{
+    // Enumerated once, the checks on the requested streams are then plain lookups
+    m_profiles.clear();
+    for (const auto& sensor : m_sensors)
+    {
+        for (const rs2::stream_profile& profile : sensor.get_stream_profiles())
+        {
+            int width  = 0;
+            int height = 0;
+            if (profile.is<rs2::video_stream_profile>())
+            {
+                auto video_stream_profile = profile.as<rs2::video_stream_profile>();
+                width  = video_stream_profile.width();
+                height = video_stream_profile.height();
+            }
+            m_profiles.emplace(profileKey(profile.stream_type(), profile.format(), width, height, profile.fps()), profile);
+        }
+    }
+
+    if (m_verbose)
+    {
+        std::cout << "Device provides the following stream profiles:" << std::endl;
+        for (const auto& entry : m_profiles)
+        {
+            std::cout << "  " << std::get<0>(entry.first) << " (" << std::get<1>(entry.first) << " " <<
+            std::get<2>(entry.first) << "x" << std::get<3>(entry.first) << "@ " << std::get<4>(entry.first) << "Hz)" << std::endl;
+        }
+    }
+}
+
+bool realsense2Driver::isSupportedProfile(rs2_stream stream, rs2_format format, int width, int height, int fps) const
+{
+    return m_profiles.find(profileKey(stream, format, width, height, fps)) != m_profiles.end();
+}
+
+bool realsense2Driver::applyStreamSettings(const streamSettings& settings)
+{
+    // m_cfg and the stream state are also changed by the lazy streams of the getters
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    // All the streams are validated before touching m_cfg, so that a rejected change
+    // leaves the running configuration untouched and costs no restart.
+    bool supported = isSupportedProfile(RS2_STREAM_COLOR, m_rgbFormat, settings.rgbWidth, settings.rgbHeight, settings.rgbFps) &&
+                     isSupportedProfile(RS2_STREAM_DEPTH, RS2_FORMAT_Z16, settings.depthWidth, settings.depthHeight, settings.depthFps);
+    if (supported && m_stereoMode)
+    {
+        supported = isSupportedProfile(RS2_STREAM_INFRARED, RS2_FORMAT_Y8, settings.rgbWidth, settings.rgbHeight, settings.depthFps);
+    }
+    if (!supported)
+    {
+        yCWarning(REALSENSE2) << "Format not supported, use --verbose for more details. Keeping the current format";
+        std::cout<<"COLOR: "<<m_streams.rgbWidth<<"x"<<m_streams.rgbHeight<<" fps: "<<m_streams.rgbFps<<std::endl;
+        std::cout<<"DEPTH: "<<m_streams.depthWidth<<"x"<<m_streams.depthHeight<<" fps: "<<m_streams.depthFps<<std::endl;
+        return false;
+    }
+
+    // The geometry is read from all the streams, the lazy ones not read anymore are paused again later
+    m_activeStreams = m_requestedStreams;
+    enableStreams(settings);
+    if (!pipelineRestart())
+        return false;
+
+    m_streams = settings;
+    m_independentStreams = m_streams.rgbFps != m_streams.depthFps;
+    updateTransformations();
+    return true;
+}
+
+void realsense2Driver::warmup()
+{
+    // Camera warmup - Dropped frames to allow stabilization of the auto exposure
+    if (m_warmupFrames <= 0)
+    {
+        return;
+    }
+
+    yCInfo(REALSENSE2) << "Sensor warm-up...";
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(m_warmupTimeout);
+    int dropped = 0;
+    int failures = 0;
+    for (; dropped < m_warmupFrames; dropped++)
+    {
+        if (m_warmupTimeout > 0 && std::chrono::steady_clock::now() > deadline)
+        {
+            yCWarning(REALSENSE2) << "Warm-up timeout reached after" << dropped << "frames";
+            break;
+        }
+        try
+        {
+            rs2::frameset data;
+            if (!waitForFrameset(data, acquisitionTimeoutMs))
+            {
+                failures++;
+                m_lastError = "Timeout waiting for frames";
+            }
+        }
+        catch (const rs2::error& e)
+        {
+            failures++;
+            m_lastError = e.what();
+        }
+    }
+    if (failures > 0)
+    {
+        yCWarning(REALSENSE2) << failures << "of" << dropped << "warm-up frames failed, last error:" << m_lastError;
+    }
+    yCInfo(REALSENSE2) << "Device ready!";
+}
+
+bool realsense2Driver::initializeRealsenseDevice(const streamSettings& settings)
+{
+    if (!m_playbackFile.empty())
+    {
+        // Frames are read from the recording, no device is acquired. The playback is repeated,
+        // so that the device can run for longer than the recording.
+        yCInfo(REALSENSE2) << "Playing back the recording" << m_playbackFile;
+        try
+        {
+            m_cfg.enable_device_from_file(m_playbackFile, true);
+        }
+        catch (const rs2::error& e)
+        {
+            yCError(REALSENSE2) << "Failed to open the recording" << m_playbackFile << "(" << e.what() << ")";
+            m_lastError = e.what();
+            return false;
+        }
+    }
+    else if (realsense2Context::connectedSerials().empty())
+    {
+        yCError(REALSENSE2) << "No device connected, please connect a RealSense device";
+
+        rs2::device_hub device_hub(realsense2Context::sharedContext());
+
+        //Using the device_hub we can block the program until a device connects
+        device_hub.wait_for_device();
+    }
+
+    // The device is acquired before starting the pipeline, so that instances opened in parallel get different devices
+    if (m_playbackFile.empty())
+    {
+        if (!realsense2Context::acquireDevice(m_serial, false, m_acquiredSerial))
+        {
+            if (m_serial.empty())
+                yCError(REALSENSE2) << "No RealSense device available, all the connected ones are already in use";
+            else
+                yCError(REALSENSE2) << "The device with serial number" << m_serial << "is not connected or already in use";
+            return false;
+        }
+        yCInfo(REALSENSE2) << "Using the device with serial number" << m_acquiredSerial;
+        m_cfg.enable_device(m_acquiredSerial);
+    }
+
+    // The pipeline is started once, directly with the requested streams
+    enableStreams(settings);
+    if (!pipelineStartup())
+    {
+        realsense2Context::releaseDevice(m_acquiredSerial);
+        m_acquiredSerial.clear();
+        return false;
+    }
+    m_initialized = true;
+    m_streams = settings;
+    m_independentStreams = m_streams.rgbFps != m_streams.depthFps;
+
+    // From here on a failure must stop the streaming and give the device back, so that it can be opened again
+    auto failure = [this]()
+    {
+        pipelineShutdown();
+        realsense2Context::releaseDevice(m_acquiredSerial);
+        m_acquiredSerial.clear();
+        m_initialized = false;
+        return false;
+    };
+
+    // Update the selected device
+    m_device = m_profile.get_device();
+    if (m_device.is<rs2::playback>())
+    {
+        // Deliver the recorded frames as fast as they are requested, without dropping any
+        m_device.as<rs2::playback>().set_real_time(false);
+    }
+    if (m_verbose)
+        yCInfo(REALSENSE2) << get_device_information(m_device).c_str();
+
+
+    // Given a device, we can query its sensors using:
+    m_sensors = m_device.query_sensors();
+
+    yCInfo(REALSENSE2) << "Device consists of" << m_sensors.size() << "sensors. More infos using --verbose option";
+    if (m_verbose)
+    {
+        for (const auto & m_sensor : m_sensors)
+        {
+            print_supported_options(m_sensor);
+        }
+    }
+
+    for (auto & m_sensor : m_sensors)
+    {
+        if (m_sensor.is<rs2::depth_sensor>())
+        {
+            m_depth_sensor =  &m_sensor;
+            if (!getOption(RS2_OPTION_DEPTH_UNITS, m_depth_sensor, m_scale))
+            {
+                yCError(REALSENSE2) << "Failed to retrieve scale";
+                return failure();
+            }
+        }
+        else if (m_sensor.get_stream_profiles()[0].stream_type() == RS2_STREAM_COLOR)
+            m_color_sensor = &m_sensor;
+    }
+    buildProfileTable();
+    buildOptionCache();
+
+    if (m_syncMode != 0 && !setOption(RS2_OPTION_INTER_CAM_SYNC_MODE, m_depth_sensor, static_cast<float>(m_syncMode)))
+    {
+        yCError(REALSENSE2) << "Failed to set the inter camera synchronization mode";
+        return failure();
+    }
+
+    if (!m_syncGroupName.empty())
+    {
+        m_syncGroup = realsense2SyncGroup::get(m_syncGroupName);
+        m_syncGroup->join(m_acquiredSerial, m_syncMode == 1, m_syncTolerance);
+    }
+
+    if (m_timestamp_type == rs_timestamp || m_syncGroup)
+    {
+        // Map the hardware timestamps to the host clock, so that they can be compared with the yarp ones
+        // and across the devices of a synchronization group
+        for (auto & m_sensor : m_sensors)
+        {
+            if (m_sensor.supports(RS2_OPTION_GLOBAL_TIME_ENABLED))
+            {
+                setOption(RS2_OPTION_GLOBAL_TIME_ENABLED, &m_sensor, 1.0f);
+            }
+        }
+    }
+
+    // Get stream intrinsics & extrinsics
+    updateTransformations();
     return true;
 }
 
-void realsense2Driver::updateTransformations()
+bool realsense2Driver::updateTransformations()
 {
+    // Called by open() or with the device mutex locked
     rs2::pipeline_profile pipeline_profile = m_pipeline.get_active_profile();
     rs2::video_stream_profile depth_stream_profile = rs2::video_stream_profile(pipeline_profile.get_stream(RS2_STREAM_DEPTH));
     rs2::video_stream_profile color_stream_profile = rs2::video_stream_profile(pipeline_profile.get_stream(RS2_STREAM_COLOR));
 
-    m_depth_intrin = depth_stream_profile.get_intrinsics();
-    m_color_intrin = color_stream_profile.get_intrinsics();
+    // The decimation changes the depth geometry: computed here from the filter settings, and replaced
+    // by the one of the first processed depth frame in updateDepthGeometry()
+    rs2_intrinsics depth_intrin = decimateIntrinsics(depth_stream_profile.get_intrinsics(), m_depthDecimation);
+    m_depthProfileId = -1;
+    rs2_intrinsics color_intrin = color_stream_profile.get_intrinsics();
+    bool changed = !m_alignToColor || !m_alignToDepth ||
+                   !sameIntrinsics(depth_intrin, m_depth_intrin) ||
+                   !sameIntrinsics(color_intrin, m_color_intrin);
+
+    m_depth_intrin = depth_intrin;
+    m_color_intrin = color_intrin;
     m_depth_to_color = depth_stream_profile.get_extrinsics_to(color_stream_profile);
     m_color_to_depth = color_stream_profile.get_extrinsics_to(depth_stream_profile);
 
@@ -632,6 +1701,80 @@ void realsense2Driver::updateTransformations()
         m_infrared_intrin = infrared_stream_profile.get_intrinsics();
     }
 
+    if (changed)
+    {
+        // The align blocks cache their projection tables and frame pools, rebuild them only
+        // when the geometry of the streams changes.
+        m_alignToColor.reset(new rs2::align(RS2_STREAM_COLOR));
+        m_alignToDepth.reset(new rs2::align(RS2_STREAM_DEPTH));
+        updateDepthRays();
+    }
+    return changed;
+}
+
+void realsense2Driver::updateDepthGeometry(const rs2::frameset& data)
+{
+    // Called by the getters with the device mutex locked, on the post-processed frameset before the alignment
+    if (m_depthFilters.empty())
+    {
+        return;
+    }
+    rs2::depth_frame depth_frm = data.get_depth_frame();
+    if (!depth_frm || depth_frm.get_profile().unique_id() == m_depthProfileId)
+    {
+        return;
+    }
+    rs2::stream_profile profile = depth_frm.get_profile();
+    m_depthProfileId = profile.unique_id();
+    rs2_intrinsics depth_intrin = rs2::video_stream_profile(profile).get_intrinsics();
+    if (!sameIntrinsics(depth_intrin, m_depth_intrin))
+    {
+        yCWarning(REALSENSE2) << "The post-processed depth is" << depth_intrin.width << "x" << depth_intrin.height
+                              << "instead of" << m_depth_intrin.width << "x" << m_depth_intrin.height << ", intrinsics updated";
+        m_depth_intrin = depth_intrin;
+        updateDepthRays();
+    }
+}
+
+void realsense2Driver::updateDepthRays()
+{
+    // Done once per configuration, so that the point clouds need just one multiplication per coordinate
+    const size_t count = static_cast<size_t>(m_depth_intrin.width) * m_depth_intrin.height;
+    m_depthRayX.resize(count);
+    m_depthRayY.resize(count);
+    for (int v = 0; v < m_depth_intrin.height; v++)
+    {
+        for (int u = 0; u < m_depth_intrin.width; u++)
+        {
+            const float pixel[2] = { static_cast<float>(u), static_cast<float>(v) };
+            float ray[3];
+            rs2_deproject_pixel_to_point(ray, &m_depth_intrin, pixel, 1.0f);
+            m_depthRayX[v * m_depth_intrin.width + u] = ray[0];
+            m_depthRayY[v * m_depth_intrin.width + u] = ray[1];
+        }
+    }
+}
+
+void realsense2Driver::alignFrameset(rs2::frameset& data)
+{
+    if (m_alignedSequence == m_deliveredSequence && m_alignedFrameset)
+    {
+        // Already aligned for another consumer of the same frameset
+        data = m_alignedFrameset;
+        return;
+    }
+    auto start = m_statistics.now();
+    if (m_alignment_stream == RS2_STREAM_COLOR && m_alignToColor)
+    {
+        data = m_alignToColor->process(data);
+    }
+    else if (m_alignment_stream == RS2_STREAM_DEPTH && m_alignToDepth)
+    {
+        data = m_alignToDepth->process(data);
+    }
+    m_statistics.record(realsense2Stage::align, start);
+    m_alignedFrameset = data;
+    m_alignedSequence = m_deliveredSequence;
 }
 
 
@@ -661,20 +1804,6 @@ bool realsense2Driver::setParams()
             settingErrorMsg("Setting param " + params_map[clipPlanes].name + " failed... quitting.", ret);
     }
 
-    //FRAMERATE
-    if (params_map[framerate].isSetting && ret)
-    {
-        if (!params_map[framerate].val[0].isInt32() )
-            settingErrorMsg("Param " + params_map[framerate].name + " is not a int as it should be.", ret);
-        else
-            m_fps = params_map[framerate].val[0].asInt32();
-    }
-    else
-    {
-        yCWarning(REALSENSE2) << "Framerate not specified... setting 30 fps by default";
-        m_fps = 30;
-    }
-
     //EMITTER
     if (params_map[enableEmitter].isSetting && ret)
     {
@@ -724,42 +1853,6 @@ bool realsense2Driver::setParams()
         m_alignment_stream = stringRSStreamMap.at(alignmentFrameStr);
     }
 
-    //DEPTH_RES
-    if (params_map[depthRes].isSetting && ret)
-    {
-        Value p1, p2;
-        p1 = params_map[depthRes].val[0];
-        p2 = params_map[depthRes].val[1];
-
-        if (!p1.isInt32() || !p2.isInt32() )
-        {
-            settingErrorMsg("Param " + params_map[depthRes].name + " is not a int as it should be.", ret);
-        }
-
-        if (! setDepthResolution(p1.asInt32(), p2.asInt32()))
-        {
-            settingErrorMsg("Setting param " + params_map[depthRes].name + " failed... quitting.", ret);
-        }
-    }
-
-    //RGB_RES
-    if (params_map[rgbRes].isSetting && ret)
-    {
-        Value p1, p2;
-        p1 = params_map[rgbRes].val[0];
-        p2 = params_map[rgbRes].val[1];
-
-        if (!p1.isInt32() || !p2.isInt32() )
-        {
-            settingErrorMsg("Param " + params_map[rgbRes].name + " is not a int as it should be.", ret);
-        }
-
-        if (! setRgbResolution(p1.asInt32(), p2.asInt32()))
-        {
-            settingErrorMsg("Setting param " + params_map[rgbRes].name + " failed... quitting.", ret);
-        }
-    }
-
     return ret;
 }
 
@@ -782,16 +1875,208 @@ bool realsense2Driver::open(Searchable& config)
         }
     }
 
+    if (config.check("timestamp")) {
+        string temp = config.find("timestamp").asString();
+        if (temp == "yarp") {
+            m_timestamp_type = yarp_timestamp;
+        } else if (temp == "realsense") {
+            m_timestamp_type = rs_timestamp;
+        } else {
+            yCError(REALSENSE2) << "Invalid value for option 'timestamp'. Valid values are 'yarp','realsense'";
+            return false;
+        }
+    }
+
+    if (config.check("syncMode")) {
+        string temp = config.find("syncMode").asString();
+        if (temp == "none") {
+            m_syncMode = 0;
+        } else if (temp == "master") {
+            m_syncMode = 1;
+        } else if (temp == "slave") {
+            m_syncMode = 2;
+        } else {
+            yCError(REALSENSE2) << "Invalid value for option 'syncMode'. Valid values are 'none','master','slave'";
+            return false;
+        }
+    }
+    if (config.check("syncGroup")) {
+        m_syncGroupName = config.find("syncGroup").asString();
+    }
+    if (config.check("syncTolerance")) {
+        m_syncTolerance = config.find("syncTolerance").asFloat64();
+    }
+
+    if(config.check("POST_PROCESSING")) {
+        yarp::os::Property postProcessingCfg;
+        postProcessingCfg.fromString(config.findGroup("POST_PROCESSING").toString());
+        if (!setupPostProcessing(postProcessingCfg)) {
+            return false;
+        }
+    }
+
     if(config.check("rotateImage180")){
-        m_rotateImage180 = config.find("rotateImage180").asBool();
-        if (m_rotateImage180) {
-            yCInfo(REALSENSE2) << "parameter rotateImage180 enabled, the image is rotated";
+        if (config.find("rotateImage180").asBool()) {
+            m_rotation = 180;
+        }
+    }
+    if (config.check("rotateImage")) {
+        int rotation = config.find("rotateImage").asInt32();
+        if (rotation != 0 && rotation != 90 && rotation != 180 && rotation != 270) {
+            yCError(REALSENSE2) << "rotateImage must be one of 0, 90, 180, 270, got" << rotation;
+            return false;
+        }
+        m_rotation = rotation;
+    }
+    if (m_rotation != 0) {
+        yCInfo(REALSENSE2) << "the images are rotated clockwise by" << m_rotation << "degrees";
+    }
+    m_depthQuantCoeff = pow(10.0f, (float) m_depthDecimalNum);
+    m_depthConversion = realsense2Utils::selectDepthConversion(m_rotation == 180, m_depthQuantizationEnabled);
+    if (config.check("zeroCopyRgb")) {
+        m_zeroCopyRgb = config.find("zeroCopyRgb").asBool();
+        if (m_zeroCopyRgb && m_rotation != 0) {
+            yCWarning(REALSENSE2) << "zeroCopyRgb has no effect when the image is rotated, the rotated image is always copied";
+        }
+    }
+    if (config.check("depthCompression")) {
+        string temp = config.find("depthCompression").asString();
+        if (temp == "none") {
+            m_depthCompression = false;
+        } else if (temp == "rvl") {
+            m_depthCompression = true;
+        } else {
+            yCError(REALSENSE2) << "Invalid value for option 'depthCompression', it must be none or rvl";
+            return false;
+        }
+        if (m_depthCompression && m_rotation != 0) {
+            yCError(REALSENSE2) << "depthCompression is not available when the images are rotated";
+            return false;
+        }
+    }
+    if (config.check("rgbFormat")) {
+        static const std::map<std::string, rs2_format> formats = {
+            {"rgb8", RS2_FORMAT_RGB8}, {"bgr8", RS2_FORMAT_BGR8}, {"rgba8", RS2_FORMAT_RGBA8},
+            {"bgra8", RS2_FORMAT_BGRA8}, {"yuyv", RS2_FORMAT_YUYV}};
+        auto format = formats.find(config.find("rgbFormat").asString());
+        if (format == formats.end()) {
+            yCError(REALSENSE2) << "Invalid value for option 'rgbFormat'. Valid values are 'rgb8','bgr8','rgba8','bgra8','yuyv'";
+            return false;
+        }
+        m_rgbFormat = format->second;
+    }
+    if (config.check("yuyvConversion")) {
+        string temp = config.find("yuyvConversion").asString();
+        if (temp == "none") {
+            m_yuyvConversion = RS2_FORMAT_ANY;
+        } else if (temp == "rgb") {
+            m_yuyvConversion = RS2_FORMAT_RGB8;
+        } else if (temp == "bgr") {
+            m_yuyvConversion = RS2_FORMAT_BGR8;
+        } else {
+            yCError(REALSENSE2) << "Invalid value for option 'yuyvConversion'. Valid values are 'none','rgb','bgr'";
+            return false;
+        }
+    }
+    if (m_rgbFormat == RS2_FORMAT_YUYV && m_yuyvConversion == RS2_FORMAT_ANY && m_rotation != 0) {
+        yCError(REALSENSE2) << "The YUYV image cannot be rotated, set yuyvConversion to rotate it";
+        return false;
+    }
+    if (config.check("asyncAcquisition")) {
+        m_asyncAcquisition = config.find("asyncAcquisition").asBool();
+    }
+    if (config.check("processingThreads")) {
+        int threads = config.find("processingThreads").asInt32();
+        if (threads <= 0) {
+            yCError(REALSENSE2) << "Invalid value for option 'processingThreads', it must be positive";
+            return false;
+        }
+        if (threads > 1) {
+            m_workerPool.reset(new realsense2WorkerPool(static_cast<size_t>(threads)));
+        }
+    }
+    if (config.check("statisticsPeriod")) {
+        m_statisticsPeriod = config.find("statisticsPeriod").asFloat64();
+        m_statistics.setEnabled(m_statisticsPeriod > 0.0);
+    }
+    if (config.check("framePolicy")) {
+        string temp = config.find("framePolicy").asString();
+        if (temp == "all") {
+            m_framePolicy = all_frames;
+        } else if (temp == "latest") {
+            m_framePolicy = latest_frame;
+            m_frameQueueSize = 1;
+        } else {
+            yCError(REALSENSE2) << "Invalid value for option 'framePolicy'. Valid values are 'all','latest'";
+            return false;
+        }
+    }
+    if (config.check("frameQueueSize")) {
+        int size = config.find("frameQueueSize").asInt32();
+        if (size <= 0) {
+            yCError(REALSENSE2) << "Invalid value for option 'frameQueueSize', it must be positive";
+            return false;
+        }
+        m_frameQueueSize = static_cast<unsigned int>(size);
+    }
+    if (m_frameQueueSize > 0) {
+        // Frames kept in a longer queue must not hold the buffers of the librealsense frame pool
+        m_frameQueue.reset(new rs2::frame_queue(m_frameQueueSize, m_frameQueueSize > 1));
+    }
+    if (config.check("cacheOptionValues")) {
+        m_cacheOptionValues = config.find("cacheOptionValues").asBool();
+    }
+    if (config.check("warmupFrames")) {
+        m_warmupFrames = config.find("warmupFrames").asInt32();
+    }
+    if (config.check("warmupTimeout")) {
+        m_warmupTimeout = config.find("warmupTimeout").asFloat64();
+    }
+    if (config.check("warmupInBackground")) {
+        m_warmupInBackground = config.find("warmupInBackground").asBool();
+        if (m_warmupInBackground && !m_asyncAcquisition) {
+            yCWarning(REALSENSE2) << "warmupInBackground requires asyncAcquisition, the warm-up is performed in open";
+            m_warmupInBackground = false;
         }
     }
     m_verbose = config.check("verbose");
+    if (config.check("serial")) {
+        m_serial = config.find("serial").asString();
+    }
+    if (config.check("lazyStreams")) {
+        m_lazyStreams = config.find("lazyStreams").asBool();
+    }
+    if (config.check("lazyStreamsTimeout")) {
+        m_lazyStreamsTimeout = config.find("lazyStreamsTimeout").asFloat64();
+    }
+    if (config.check("watchdogTimeout")) {
+        m_watchdogTimeout = config.find("watchdogTimeout").asFloat64();
+    }
+    if (config.check("playbackFile")) {
+        m_playbackFile = config.find("playbackFile").asString();
+        if (m_watchdogTimeout > 0.0) {
+            yCWarning(REALSENSE2) << "The watchdog is disabled when playing back a recording";
+            m_watchdogTimeout = 0.0;
+        }
+        if (!m_serial.empty()) {
+            yCError(REALSENSE2) << "The serial and playbackFile parameters are mutually exclusive";
+            return false;
+        }
+        if (m_syncMode != 0 || !m_syncGroupName.empty()) {
+            yCError(REALSENSE2) << "The hardware synchronization is not available when playing back a recording";
+            return false;
+        }
+    }
     if (config.check("stereoMode")) {
         m_stereoMode = config.find("stereoMode").asBool();
     }
+    if (config.check("infraredStreams")) {
+        m_infraredStreams = config.find("infraredStreams").asInt32();
+        if (m_infraredStreams != 1 && m_infraredStreams != 2) {
+            yCError(REALSENSE2) << "Invalid value for option 'infraredStreams', it must be 1 or 2";
+            return false;
+        }
+    }
 
     if (!m_paramParser.parseParam(config, params))
     {
@@ -799,104 +2084,152 @@ bool realsense2Driver::open(Searchable& config)
         return false;
     }
 
-    if (!initializeRealsenseDevice())
+    streamSettings settings;
+    if (!parseStreamSettings(settings))
+    {
+        return false;
+    }
+
+    m_requestedStreams = color_stream | depth_stream | (m_stereoMode ? infrared_stream : 0);
+    m_activeStreams = m_requestedStreams;
+    for (auto& lastRead : m_lastRead)
+    {
+        lastRead = std::chrono::steady_clock::now();
+    }
+
+    if (!initializeRealsenseDevice(settings))
     {
         yCError(REALSENSE2) << "Failed to initialize the realsense device";
+        m_workerPool.reset();
         return false;
     }
 
+    // A failed open() is not followed by close(): from here on the streaming is stopped and the device
+    // given back here, so that another instance can open it
     // setting Parameters
-    return setParams();
+    if (!setParams())
+    {
+        realsense2Driver::close();
+        return false;
+    }
+
+    if (m_warmupInBackground)
+    {
+        yCInfo(REALSENSE2) << "Sensor warm-up in background...";
+        m_warmupPending = m_warmupFrames;
+        m_warmupDeadline = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(m_warmupTimeout));
+    }
+    else
+    {
+        // Done once, on the final stream configuration
+        warmup();
+    }
+
+    if (m_asyncAcquisition && !start())
+    {
+        yCError(REALSENSE2) << "Failed to start the acquisition thread";
+        realsense2Driver::close();
+        return false;
+    }
+
+    if (m_watchdogTimeout > 0.0)
+    {
+        m_watchdogStop = false;
+        m_watchdog = std::thread(&realsense2Driver::watchdogLoop, this);
+    }
+    return true;
+}
 
+void realsense2Driver::stopWatchdog()
+{
+    if (m_watchdog.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> guard(m_watchdogMutex);
+            m_watchdogStop = true;
+        }
+        m_watchdogCondition.notify_all();
+        m_watchdog.join();
+    }
 }
 
 bool realsense2Driver::close()
 {
+    stopWatchdog();
+    if (isRunning())
+    {
+        stop();
+    }
     pipelineShutdown();
+    m_workerPool.reset();
+    if (m_syncGroup)
+    {
+        m_syncGroup->leave(m_acquiredSerial);
+        m_syncGroup.reset();
+    }
+    realsense2Context::releaseDevice(m_acquiredSerial);
+    m_acquiredSerial.clear();
+    m_initialized = false;
     return true;
 }
 
 int realsense2Driver::getRgbHeight()
 {
-    return m_color_intrin.height;
+    return rotateIntrinsics(m_color_intrin, m_rotation).height;
 }
 
 int realsense2Driver::getRgbWidth()
 {
-    return m_color_intrin.width;
+    return rotateIntrinsics(m_color_intrin, m_rotation).width;
 }
 
 bool realsense2Driver::getRgbSupportedConfigurations(yarp::sig::VectorOf<CameraConfig> &configurations)
 {
-    yCWarning(REALSENSE2) << "getRgbSupportedConfigurations not implemented yet";
-    return false;
+    configurations.clear();
+    for (const auto& entry : m_profiles)
+    {
+        if (std::get<0>(entry.first) != RS2_STREAM_COLOR)
+        {
+            continue;
+        }
+        int pixCode = pixFormatToCode(std::get<1>(entry.first));
+        if (pixCode == VOCAB_PIXEL_INVALID)
+        {
+            continue;
+        }
+        CameraConfig config;
+        config.width       = std::get<2>(entry.first);
+        config.height      = std::get<3>(entry.first);
+        config.framerate   = std::get<4>(entry.first);
+        config.pixelCoding = static_cast<YarpVocabPixelTypesEnum>(pixCode);
+        configurations.push_back(config);
+    }
+    return true;
 }
 
 bool realsense2Driver::getRgbResolution(int &width, int &height)
 {
-    width  = m_color_intrin.width;
-    height = m_color_intrin.height;
+    width  = getRgbWidth();
+    height = getRgbHeight();
     return true;
 }
 
 bool realsense2Driver::setDepthResolution(int width, int height)
 {
-    if (m_depth_sensor && isSupportedFormat(*m_depth_sensor, width, height, m_fps, m_verbose))
-    {
-        m_cfg.enable_stream(RS2_STREAM_COLOR, m_color_intrin.width, m_color_intrin.height, RS2_FORMAT_RGB8, m_fps);
-        m_cfg.enable_stream(RS2_STREAM_DEPTH, width, height, RS2_FORMAT_Z16, m_fps);
-    }
-    else
-    {
-        if (m_initialized)
-        {
-            fallback();
-            return false;
-        }
-    }
-
-    if (!pipelineRestart())
-        return false;
-
-    updateTransformations();
-    return true;
+    streamSettings settings = m_streams;
+    settings.depthWidth  = width;
+    settings.depthHeight = height;
+    return applyStreamSettings(settings);
 }
 
 bool realsense2Driver::setRgbResolution(int width, int height)
 {
-    bool fail = true;
-    if (m_color_sensor && isSupportedFormat(*m_color_sensor, width, height, m_fps, m_verbose)) {
-        m_cfg.enable_stream(RS2_STREAM_COLOR, width, height, RS2_FORMAT_RGB8, m_fps);
-        m_cfg.enable_stream(RS2_STREAM_DEPTH, m_depth_intrin.width, m_depth_intrin.height, RS2_FORMAT_Z16, m_fps);
-        fail = false;
-        if (m_stereoMode)
-        {
-            if (m_depth_sensor && isSupportedFormat(*m_depth_sensor, width, height, m_fps, m_verbose))
-            {
-                m_cfg.enable_stream(RS2_STREAM_INFRARED, 1, width, height, RS2_FORMAT_Y8, m_fps);
-                m_cfg.enable_stream(RS2_STREAM_INFRARED, 2, width, height, RS2_FORMAT_Y8, m_fps);
-            }
-            else
-            {
-                fail = true;
-            }
-        }
-    }
-
-    if (m_initialized && fail)
-    {
-        fallback();
-        return false;
-    }
-
-    if (!pipelineRestart())
-        return false;
-
-    updateTransformations();
-    return true;
+    streamSettings settings = m_streams;
+    settings.rgbWidth  = width;
+    settings.rgbHeight = height;
+    return applyStreamSettings(settings);
 }
 
-
 bool realsense2Driver::setRgbFOV(double horizontalFov, double verticalFov)
 {
     // It seems to be not available...
@@ -922,7 +2255,8 @@ bool realsense2Driver::setDepthAccuracy(double accuracy)
 bool realsense2Driver::getRgbFOV(double &horizontalFov, double &verticalFov)
 {
     float fov[2];
-    rs2_fov(&m_color_intrin, fov);
+    rs2_intrinsics intrin = rotateIntrinsics(m_color_intrin, m_rotation);
+    rs2_fov(&intrin, fov);
     horizontalFov = fov[0];
     verticalFov   = fov[1];
     return true;
@@ -942,23 +2276,24 @@ bool realsense2Driver::setRgbMirroring(bool mirror)
 
 bool realsense2Driver::getRgbIntrinsicParam(Property& intrinsic)
 {
-    return setIntrinsic(intrinsic, m_color_intrin);
+    return setIntrinsic(intrinsic, rotateIntrinsics(m_color_intrin, m_rotation));
 }
 
 int  realsense2Driver::getDepthHeight()
 {
-    return m_depth_intrin.height;
+    return rotateIntrinsics(m_depth_intrin, m_rotation).height;
 }
 
 int  realsense2Driver::getDepthWidth()
 {
-    return m_depth_intrin.width;
+    return rotateIntrinsics(m_depth_intrin, m_rotation).width;
 }
 
 bool realsense2Driver::getDepthFOV(double& horizontalFov, double& verticalFov)
 {
     float fov[2];
-    rs2_fov(&m_depth_intrin, fov);
+    rs2_intrinsics intrin = rotateIntrinsics(m_depth_intrin, m_rotation);
+    rs2_fov(&intrin, fov);
     horizontalFov = fov[0];
     verticalFov   = fov[1];
     return true;
@@ -966,7 +2301,7 @@ bool realsense2Driver::getDepthFOV(double& horizontalFov, double& verticalFov)
 
 bool realsense2Driver::getDepthIntrinsicParam(Property& intrinsic)
 {
-    return setIntrinsic(intrinsic, m_depth_intrin);;
+    return setIntrinsic(intrinsic, rotateIntrinsics(m_depth_intrin, m_rotation));
 }
 
 double realsense2Driver::getDepthAccuracy()
@@ -1018,57 +2353,164 @@ bool realsense2Driver::setDepthMirroring(bool mirror)
 
 bool realsense2Driver::getExtrinsicParam(Matrix& extrinsic)
 {
-    return setExtrinsicParam(extrinsic, m_depth_to_color);
+    return setExtrinsicParam(extrinsic, rotateExtrinsics(m_depth_to_color, m_rotation));
 }
 
 bool realsense2Driver::getRgbImage(FlexImage& rgbImage, Stamp* timeStamp)
 {
-    std::lock_guard<std::mutex> guard(m_mutex);
     rs2::frameset data;
-    try
-    {
-        data = m_pipeline.wait_for_frames();
-    }
-    catch (const rs2::error& e)
+    auto guard = acquireFrameset(color_stream | (m_alignment_stream == RS2_STREAM_DEPTH ? depth_stream : 0), data);
+    if (!guard)
     {
-        yCError(REALSENSE2) << "m_pipeline.wait_for_frames() failed with error:"<< "(" << e.what() << ")";
-         m_lastError = e.what();
         return false;
     }
     if (m_alignment_stream == RS2_STREAM_DEPTH)
     {
-        rs2::align align(m_alignment_stream);
-        data = align.process(data);
+        alignFrameset(data);
     }
     return getImage(rgbImage, timeStamp, data);
 }
 
 bool realsense2Driver::getDepthImage(ImageOf<PixelFloat>& depthImage, Stamp* timeStamp)
 {
-    std::lock_guard<std::mutex> guard(m_mutex);
     rs2::frameset data;
-    try
+    auto guard = acquireFrameset(depth_stream | (m_alignment_stream == RS2_STREAM_COLOR ? color_stream : 0), data);
+    if (!guard)
     {
-        data = m_pipeline.wait_for_frames();
+        return false;
     }
-    catch (const rs2::error& e)
+    if (m_alignment_stream == RS2_STREAM_COLOR)
+    {
+        alignFrameset(data);
+    }
+    return getImage(depthImage, timeStamp, data);
+}
+
+bool realsense2Driver::getDepthImage(depthImageRaw& depthImage, Stamp* timeStamp)
+{
+    rs2::frameset data;
+    auto guard = acquireFrameset(depth_stream | (m_alignment_stream == RS2_STREAM_COLOR ? color_stream : 0), data);
+    if (!guard)
     {
-        yCError(REALSENSE2) << "m_pipeline.wait_for_frames() failed with error:"<< "(" << e.what() << ")";
-        m_lastError = e.what();
         return false;
     }
     if (m_alignment_stream == RS2_STREAM_COLOR)
     {
-        rs2::align align(m_alignment_stream);
-        data = align.process(data);
+        alignFrameset(data);
     }
     return getImage(depthImage, timeStamp, data);
 }
 
+double realsense2Driver::getDepthScale() const
+{
+    return m_scale;
+}
+
+bool realsense2Driver::getPointCloud(PointCloud<DataXYZ>& cloud, Stamp* timeStamp)
+{
+    rs2::frameset data;
+    auto guard = acquireFrameset(depth_stream, data);
+    if (!guard)
+    {
+        return false;
+    }
+    return deprojectFrame(cloud, timeStamp, data.get_depth_frame());
+}
+
+bool realsense2Driver::getPointCloud(PointCloud<DataXYZRGBA>& cloud, Stamp* timeStamp)
+{
+    rs2::frameset data;
+    auto guard = acquireFrameset(depth_stream | color_stream, data);
+    if (!guard)
+    {
+        return false;
+    }
+    if (m_alignToDepth)
+    {
+        data = m_alignToDepth->process(data);
+    }
+    rs2::depth_frame depth_frm = data.get_depth_frame();
+    rs2::video_frame color_frm = data.get_color_frame();
+    if (!deprojectFrame(cloud, timeStamp, depth_frm))
+    {
+        return false;
+    }
+
+    if (!color_frm)
+    {
+        yCError(REALSENSE2) << "The frameset has no color frame";
+        return false;
+    }
+    rs2_format format = color_frm.get_profile().format();
+    const size_t bpp = bytesPerPixel(format);
+    bool bgr = format == RS2_FORMAT_BGR8 || format == RS2_FORMAT_BGRA8;
+    if (bpp < 3 || color_frm.get_width() != depth_frm.get_width() || color_frm.get_height() != depth_frm.get_height())
+    {
+        yCError(REALSENSE2) << "The color frame cannot be used to color the point cloud";
+        return false;
+    }
+    const auto* color = (const unsigned char*) color_frm.get_data();
+    const size_t stride = color_frm.get_stride_in_bytes();
+    for (int v = 0; v < depth_frm.get_height(); v++)
+    {
+        const unsigned char* row = color + v * stride;
+        for (int u = 0; u < depth_frm.get_width(); u++)
+        {
+            DataXYZRGBA& point = cloud(u, v);
+            const unsigned char* pixel = row + u * bpp;
+            point.r = bgr ? pixel[2] : pixel[0];
+            point.g = pixel[1];
+            point.b = bgr ? pixel[0] : pixel[2];
+            point.a = 255;
+        }
+    }
+    return true;
+}
+
+template <class T>
+bool realsense2Driver::deprojectFrame(PointCloud<T>& cloud, Stamp* timeStamp, const rs2::depth_frame& depth_frm)
+{
+    static_assert(sizeof(T) % sizeof(float) == 0, "The point type must be a multiple of a float");
+
+    if (!depth_frm)
+    {
+        yCError(REALSENSE2) << "The frameset has no depth frame";
+        return false;
+    }
+    const int w = depth_frm.get_width();
+    const int h = depth_frm.get_height();
+    const size_t count = static_cast<size_t>(w) * h;
+    if (count != m_depthRayX.size())
+    {
+        yCError(REALSENSE2) << "The depth frame does not match the depth intrinsics";
+        return false;
+    }
+
+    cloud.resize(w, h);
+    realsense2Utils::deprojectDepth((const uint16_t*) depth_frm.get_data(), m_depthRayX.data(), m_depthRayY.data(),
+                                    count, m_scale, &cloud.data()->x, sizeof(T) / sizeof(float));
+
+    updateStamp(m_depth_stamp, depth_frm);
+    if (timeStamp != nullptr)
+    {
+        *timeStamp = m_depth_stamp;
+    }
+    return true;
+}
+
 bool realsense2Driver::getImage(FlexImage& Frame, Stamp *timeStamp, rs2::frameset &sourceFrame)
 {
+    realsense2Statistics::scope timing(m_statistics, realsense2Stage::colorConvert);
     rs2::video_frame color_frm = sourceFrame.get_color_frame();
-    rs2_format format = color_frm.get_profile().format();
+    if (!color_frm)
+    {
+        yCError(REALSENSE2) << "The frameset has no color frame";
+        return false;
+    }
+    rs2_format sourceFormat = color_frm.get_profile().format();
+    // YUYV is delivered as is, or converted here in a single pass
+    bool convert = sourceFormat == RS2_FORMAT_YUYV && m_yuyvConversion != RS2_FORMAT_ANY;
+    rs2_format format = convert ? m_yuyvConversion : sourceFormat;
 
     int pixCode = pixFormatToCode(format);
     size_t mem_to_wrt = color_frm.get_width() * color_frm.get_height() * bytesPerPixel(format);
@@ -1080,24 +2522,69 @@ bool realsense2Driver::getImage(FlexImage& Frame, Stamp *timeStamp, rs2::framese
     }
 
     Frame.setPixelCode(pixCode);
-    Frame.resize(m_color_intrin.width, m_color_intrin.height);
+
+    // A frame borrowed by another consumer stays alive until its next call, meanwhile the others receive a copy
+    bool borrowedByOther = m_zeroCopyColorFrame && m_zeroCopyColorOwner != m_consumer;
+    if (!borrowedByOther)
+    {
+        m_zeroCopyColorFrame = rs2::frame();
+    }
+    if (m_zeroCopyRgb && m_rotation == 0 && !convert && !borrowedByOther &&
+        (size_t) color_frm.get_stride_in_bytes() == color_frm.get_width() * bytesPerPixel(format))
+    {
+        // Borrow the librealsense buffer: the frame is kept alive until the next color image requested by this consumer
+        m_zeroCopyColorFrame = color_frm;
+        m_zeroCopyColorOwner = m_consumer;
+        Frame.setQuantum(1);
+        Frame.setExternal(color_frm.get_data(), color_frm.get_width(), color_frm.get_height());
+        updateStamp(m_rgb_stamp, color_frm);
+        if (timeStamp != nullptr)
+        {
+            *timeStamp = m_rgb_stamp;
+        }
+        return true;
+    }
+
+    if (m_rotation != 0 || convert)
+    {
+        // The rotation and conversion kernels work on tightly packed rows
+        Frame.setQuantum(1);
+    }
+    Frame.resize(getRgbWidth(), getRgbHeight());
 
     if ((size_t) Frame.getRawImageSize() != mem_to_wrt)
     {
         yCError(REALSENSE2) << "Device and local copy data size doesn't match";
         return false;
     }
-    if (m_rotateImage180) {
-        for (int i = 0; i < (color_frm.get_width() * color_frm.get_height()); i++) {
-            for (size_t pixelIndex = 0; pixelIndex < bytesPerPixel(format); pixelIndex++) {
-                ((char *)Frame.getRawImage())[i * bytesPerPixel(format) + pixelIndex] = ((char *)color_frm.get_data())[
-                        ( Frame.getRawImageSize()  -(( i-1) * bytesPerPixel(format))) + pixelIndex];
+    const auto* source = (const unsigned char*) color_frm.get_data();
+    const size_t pixels = static_cast<size_t>(color_frm.get_width()) * color_frm.get_height();
+    // With several consumers of the same frameset the converted image is kept and copied by the next ones
+    bool cached = false;
+    const bool shared = (convert || m_rotation != 0) && m_colorImageCache.use(m_deliveredSequence, mem_to_wrt, cached);
+    if (cached) {
+        memcpy(Frame.getRawImage(), m_colorImageCache.data.data(), mem_to_wrt);
+    } else {
+        unsigned char* target = shared ? m_colorImageCache.data.data() : Frame.getRawImage();
+        if (convert && m_rotation == 0) {
+            realsense2Utils::convertYuyv(source, target, pixels, format == RS2_FORMAT_BGR8);
+        } else if (m_rotation != 0) {
+            if (convert) {
+                m_colorConversionBuffer.resize(mem_to_wrt);
+                realsense2Utils::convertYuyv(source, m_colorConversionBuffer.data(), pixels, format == RS2_FORMAT_BGR8);
+                source = m_colorConversionBuffer.data();
             }
+            realsense2Utils::rotateImage(source, target,
+                                         color_frm.get_width(), color_frm.get_height(), bytesPerPixel(format), m_rotation);
+        } else {
+            memcpy((void*)target, (void*)color_frm.get_data(), mem_to_wrt);
+        }
+        if (shared) {
+            memcpy(Frame.getRawImage(), target, mem_to_wrt);
+            m_colorImageCache.valid = true;
         }
-    } else {
-        memcpy((void*)Frame.getRawImage(), (void*)color_frm.get_data(), mem_to_wrt);
     }
-    m_rgb_stamp.update();
+    updateStamp(m_rgb_stamp, color_frm);
     if (timeStamp != nullptr)
     {
         *timeStamp = m_rgb_stamp;
@@ -1107,7 +2594,13 @@ bool realsense2Driver::getImage(FlexImage& Frame, Stamp *timeStamp, rs2::framese
 
 bool realsense2Driver::getImage(depthImage& Frame, Stamp *timeStamp, const rs2::frameset &sourceFrame)
 {
+    realsense2Statistics::scope timing(m_statistics, realsense2Stage::depthConvert);
     rs2::depth_frame depth_frm = sourceFrame.get_depth_frame();
+    if (!depth_frm)
+    {
+        yCError(REALSENSE2) << "The frameset has no depth frame";
+        return false;
+    }
     rs2_format format = depth_frm.get_profile().format();
 
     int pixCode = pixFormatToCode(format);
@@ -1121,29 +2614,198 @@ bool realsense2Driver::getImage(depthImage& Frame, Stamp *timeStamp, const rs2::
         return false;
     }
 
-    Frame.resize(w, h);
-
-    float* rawImage = &Frame.pixel(0,0);
     const auto * rawImageRs =(const uint16_t *) depth_frm.get_data();
-    double nearPlane;
-    double farPlane;
-    int intTemp;
-    getDepthClipPlanes(nearPlane, farPlane);
-    float powCoeff = pow(10.0f, (float) m_depthDecimalNum);
-    for(int i = 0; i < w * h; i++)
+    const size_t count = static_cast<size_t>(w) * h;
+    const bool transpose = m_rotation == 90 || m_rotation == 270;
+    if (transpose)
+    {
+        Frame.setQuantum(1);
+        Frame.resize(h, w);
+    }
+    else
+    {
+        Frame.resize(w, h);
+    }
+    float* rawImage = &Frame.pixel(0,0);
+
+    // With several consumers of the same frameset the converted image is kept and copied by the next ones
+    bool cached = false;
+    const bool shared = m_depthImageCache.use(m_deliveredSequence, count, cached);
+    if (cached)
+    {
+        memcpy(rawImage, m_depthImageCache.data.data(), count * sizeof(float));
+    }
+    else
+    {
+        float* target = shared ? m_depthImageCache.data.data() : rawImage;
+        if (transpose)
+        {
+            // Convert first, then transpose the float samples
+            m_depthRotationBuffer.resize(count);
+            convertDepth(rawImageRs, m_depthRotationBuffer.data(), count);
+            realsense2Utils::rotateImage((const unsigned char*) m_depthRotationBuffer.data(), (unsigned char*) target,
+                                         w, h, sizeof(float), m_rotation);
+        }
+        else
+        {
+            convertDepth(rawImageRs, target, count);
+        }
+        if (shared)
+        {
+            memcpy(rawImage, target, count * sizeof(float));
+            m_depthImageCache.valid = true;
+        }
+    }
+
+    updateStamp(m_depth_stamp, depth_frm);
+    if (timeStamp != nullptr)
+    {
+        *timeStamp = m_depth_stamp;
+    }
+    return true;
+}
+
+void realsense2Driver::encodeDepth(const rs2::depth_frame& depth, std::vector<uint16_t>& scratch, std::vector<unsigned char>& encoded) const
+{
+    const auto* samples = static_cast<const uint16_t*>(depth.get_data());
+    const size_t count = static_cast<size_t>(depth.get_width()) * depth.get_height();
+    // The quantization removes the depth units below the delivered decimals, which otherwise cost
+    // most of the coded deltas: the quantization steps are coded instead of the depth units
+    if (quantizedCompression())
+    {
+        scratch.resize(count);
+        realsense2Utils::quantizeDepth(samples, scratch.data(), count, m_scale, m_depthQuantCoeff);
+        samples = scratch.data();
+    }
+    encoded.clear();
+    realsense2Utils::encodeRvl(samples, count, encoded);
+}
+
+bool realsense2Driver::quantizedCompression() const
+{
+    // With steps finer than the depth unit the depth is already quantized, and the steps could exceed 16 bits
+    return m_depthQuantizationEnabled && m_scale * m_depthQuantCoeff < 1.0f;
+}
+
+double realsense2Driver::getCompressedDepthScale() const
+{
+    return quantizedCompression() ? 1.0 / m_depthQuantCoeff : m_scale;
+}
+
+bool realsense2Driver::getCompressedDepthImage(std::vector<unsigned char>& data, int& width, int& height, Stamp* timeStamp)
+{
+    if (!m_depthCompression)
+    {
+        yCError(REALSENSE2) << "Depth compression not enabled";
+        return false;
+    }
+
+    rs2::frameset frames;
+    auto guard = acquireFrameset(depth_stream | (m_alignment_stream == RS2_STREAM_COLOR ? color_stream : 0), frames);
+    if (!guard)
+    {
+        return false;
+    }
+    if (m_alignment_stream == RS2_STREAM_COLOR)
+    {
+        alignFrameset(frames);
+    }
+    rs2::depth_frame depth_frm = frames.get_depth_frame();
+    if (!depth_frm)
+    {
+        yCError(REALSENSE2) << "The frameset has no depth frame";
+        return false;
+    }
+
+    std::shared_ptr<const std::vector<unsigned char>> encoded;
+    {
+        std::lock_guard<std::mutex> frameGuard(m_frameMutex);
+        if (m_compressedSequence == m_deliveredSequence)
+        {
+            encoded = m_latestCompressedDepth;
+        }
+    }
+    if (encoded)
+    {
+        data = *encoded;
+    }
+    else
+    {
+        encodeDepth(depth_frm, m_compressionScratch, data);
+    }
+
+    width  = depth_frm.get_width();
+    height = depth_frm.get_height();
+    updateStamp(m_depth_stamp, depth_frm);
+    if (timeStamp != nullptr)
+    {
+        *timeStamp = m_depth_stamp;
+    }
+    return true;
+}
+
+void realsense2Driver::convertDepth(const uint16_t* src, float* dst, size_t count)
+{
+    if (!m_workerPool)
+    {
+        m_depthConversion(src, dst, count, m_scale, m_depthQuantCoeff);
+        return;
+    }
+    // Every stripe is a smaller conversion: with the reversed (180 degrees) kernels the
+    // destination range [begin, end) comes from the source range [count - end, count - begin)
+    const bool reverse = m_rotation == 180;
+    m_workerPool->parallelFor(count, [&](size_t begin, size_t end)
+    {
+        const uint16_t* stripe = reverse ? src + count - end : src + begin;
+        m_depthConversion(stripe, dst + begin, end - begin, m_scale, m_depthQuantCoeff);
+    });
+}
+
+bool realsense2Driver::getImage(depthImageRaw& Frame, Stamp *timeStamp, const rs2::frameset &sourceFrame)
+{
+    realsense2Statistics::scope timing(m_statistics, realsense2Stage::depthConvert);
+    rs2::depth_frame depth_frm = sourceFrame.get_depth_frame();
+    if (!depth_frm)
+    {
+        yCError(REALSENSE2) << "The frameset has no depth frame";
+        return false;
+    }
+
+    if (pixFormatToCode(depth_frm.get_profile().format()) != VOCAB_PIXEL_MONO16)
+    {
+        yCError(REALSENSE2) << "Expecting Pixel Format MONO16";
+        return false;
+    }
+
+    int w = depth_frm.get_width();
+    int h = depth_frm.get_height();
+    const auto * rawImageRs = (const uint16_t *) depth_frm.get_data();
+
+    if (m_rotation != 0)
     {
-        if (m_rotateImage180) {
-            rawImage[i] = m_scale * rawImageRs[(w * h) - i -1];
-        }else {
-            rawImage[i] = m_scale * rawImageRs[i];
+        Frame.setQuantum(1);
+        if (m_rotation == 180)
+        {
+            Frame.resize(w, h);
+        }
+        else
+        {
+            Frame.resize(h, w);
         }
-        if (m_depthQuantizationEnabled) {
-            intTemp = (int) (rawImage[i] * powCoeff);
-            rawImage[i] = ((float) intTemp) / powCoeff;
+        realsense2Utils::rotateImage((const unsigned char*) rawImageRs, Frame.getRawImage(),
+                                     w, h, sizeof(uint16_t), m_rotation);
+    }
+    else
+    {
+        // Plain row copies, the yarp image rows may be padded
+        Frame.resize(w, h);
+        for (int y = 0; y < h; y++)
+        {
+            memcpy(Frame.getRow(y), rawImageRs + y * w, w * sizeof(uint16_t));
         }
     }
 
-    m_depth_stamp.update();
+    updateStamp(m_depth_stamp, depth_frm);
     if (timeStamp != nullptr)
     {
         *timeStamp = m_depth_stamp;
@@ -1153,28 +2815,63 @@ bool realsense2Driver::getImage(depthImage& Frame, Stamp *timeStamp, const rs2::
 
 bool realsense2Driver::getImages(FlexImage& colorFrame, ImageOf<PixelFloat>& depthFrame, Stamp* colorStamp, Stamp* depthStamp)
 {
-    std::lock_guard<std::mutex> guard(m_mutex);
     rs2::frameset data;
-    try
+    auto guard = acquireFrameset(color_stream | depth_stream, data);
+    if (!guard)
     {
-        data = m_pipeline.wait_for_frames();
+        return false;
     }
-    catch (const rs2::error& e)
+    if (m_alignment_stream != RS2_STREAM_ANY) // RS2_STREAM_ANY is used as no-alignment-needed value.
+    {
+        alignFrameset(data);
+    }
+    if (!m_workerPool)
+    {
+        return getImage(colorFrame, colorStamp, data) && getImage(depthFrame, depthStamp, data);
+    }
+
+    // The color copy runs on a worker while this thread converts the depth with the others
+    bool colorOk = false;
+    bool depthOk = false;
+    std::vector<std::function<void()>> tasks;
+    tasks.emplace_back([&] { depthOk = getImage(depthFrame, depthStamp, data); });
+    tasks.emplace_back([&] { colorOk = getImage(colorFrame, colorStamp, data); });
+    m_workerPool->run(tasks);
+    return colorOk && depthOk;
+}
+
+bool realsense2Driver::getImages(FlexImage& colorFrame, depthImageRaw& depthFrame, Stamp* colorStamp, Stamp* depthStamp)
+{
+    rs2::frameset data;
+    auto guard = acquireFrameset(color_stream | depth_stream, data);
+    if (!guard)
     {
-        yCError(REALSENSE2) << "m_pipeline.wait_for_frames() failed with error:"<< "(" << e.what() << ")";
-        m_lastError = e.what();
         return false;
     }
     if (m_alignment_stream != RS2_STREAM_ANY) // RS2_STREAM_ANY is used as no-alignment-needed value.
     {
-        rs2::align align(m_alignment_stream);
-        data = align.process(data);
+        alignFrameset(data);
+    }
+    if (!m_workerPool)
+    {
+        return getImage(colorFrame, colorStamp, data) && getImage(depthFrame, depthStamp, data);
     }
-    return getImage(colorFrame, colorStamp, data) && getImage(depthFrame, depthStamp, data);
+
+    bool colorOk = false;
+    bool depthOk = false;
+    std::vector<std::function<void()>> tasks;
+    tasks.emplace_back([&] { depthOk = getImage(depthFrame, depthStamp, data); });
+    tasks.emplace_back([&] { colorOk = getImage(colorFrame, colorStamp, data); });
+    m_workerPool->run(tasks);
+    return colorOk && depthOk;
 }
 
 IRGBDSensor::RGBDSensor_status realsense2Driver::getSensorStatus()
 {
+    if (m_reconnecting)
+    {
+        return RGBD_SENSOR_TIMEOUT;
+    }
     return RGBD_SENSOR_OK_IN_USE;
 }
 
@@ -1307,7 +3004,7 @@ bool realsense2Driver::getFeature(int feature, double *value)
     case YARP_FEATURE_FRAME_RATE:
     {
         b = true;
-        *value = (double) m_fps;
+        *value = (double) m_streams.rgbFps;
         break;
     }
     case YARP_FEATURE_WHITE_BALANCE:
@@ -1600,36 +3297,106 @@ bool realsense2Driver::getImage(yarp::sig::ImageOf<yarp::sig::PixelMono>& image)
         return false;
     }
 
-    image.resize(width(), height());
-    std::lock_guard<std::mutex> guard(m_mutex);
     rs2::frameset data;
-    try
+    auto guard = acquireFrameset(infrared_stream, data);
+    if (!guard)
     {
-        data = m_pipeline.wait_for_frames();
+        return false;
     }
-    catch (const rs2::error& e)
+
+    rs2::video_frame frm1 = data.get_infrared_frame(1);
+    if (!frm1 || pixFormatToCode(frm1.get_profile().format()) != VOCAB_PIXEL_MONO)
     {
-        yCError(REALSENSE2) << "m_pipeline.wait_for_frames() failed with error:"<< "(" << e.what() << ")";
-        m_lastError = e.what();
+        yCError(REALSENSE2) << "Expecting Pixel Format MONO";
         return false;
     }
 
-    rs2::video_frame frm1 = data.get_infrared_frame(1);
+    const int w = frm1.get_width();
+    const int h = frm1.get_height();
+    if (m_infraredStreams == 1)
+    {
+        image.resize(w, h);
+        const auto* src = static_cast<const unsigned char*>(frm1.get_data());
+        for (int row = 0; row < h; row++)
+        {
+            memcpy(image.getRow(row), src + row * frm1.get_stride_in_bytes(), w);
+        }
+        return true;
+    }
+
     rs2::video_frame frm2 = data.get_infrared_frame(2);
+    if (!frm2 || frm2.get_width() != w || frm2.get_height() != h)
+    {
+        yCError(REALSENSE2) << "Missing or mismatching right infrared frame";
+        return false;
+    }
 
-    int pixCode = pixFormatToCode(frm1.get_profile().format());
+    // Side by side in a single pass, each output row is the concatenation of the rows of the two frames
+    image.resize(2 * w, h);
+    const auto* left  = static_cast<const unsigned char*>(frm1.get_data());
+    const auto* right = static_cast<const unsigned char*>(frm2.get_data());
+    for (int row = 0; row < h; row++)
+    {
+        unsigned char* dst = image.getRow(row);
+        memcpy(dst,     left  + row * frm1.get_stride_in_bytes(), w);
+        memcpy(dst + w, right + row * frm2.get_stride_in_bytes(), w);
+    }
+    return true;
+}
 
-    if (pixCode != VOCAB_PIXEL_MONO)
+bool realsense2Driver::getInfraredImages(ImageOf<PixelMono>& left, ImageOf<PixelMono>& right, Stamp* timeStamp)
+{
+    if (!m_stereoMode)
+    {
+        yCError(REALSENSE2)<<"Infrared stereo stream not enabled";
+        return false;
+    }
+
+    rs2::frameset data;
+    auto guard = acquireFrameset(infrared_stream, data);
+    if (!guard)
     {
-        yCError(REALSENSE2) << "Expecting Pixel Format MONO";
         return false;
     }
 
-    // Wrap rs images with yarp ones.
-    ImageOf<PixelMono> imgL, imgR;
-    imgL.setExternal((unsigned char*) (frm1.get_data()), frm1.get_width(), frm1.get_height());
-    imgR.setExternal((unsigned char*) (frm2.get_data()), frm2.get_width(), frm2.get_height());
-    return utils::horzConcat(imgL, imgR, image);
+    // Frames borrowed by another consumer stay alive until its next call, meanwhile the others receive a copy
+    bool borrowedByOther = (m_zeroCopyInfraredFrames[0] || m_zeroCopyInfraredFrames[1]) && m_zeroCopyInfraredOwner != m_consumer;
+    if (!borrowedByOther)
+    {
+        m_zeroCopyInfraredFrames[0] = rs2::frame();
+        m_zeroCopyInfraredFrames[1] = rs2::frame();
+        m_zeroCopyInfraredOwner = m_consumer;
+    }
+    ImageOf<PixelMono>* images[2] = { &left, &right };
+    for (int i = 0; i < m_infraredStreams; i++)
+    {
+        rs2::video_frame frm = data.get_infrared_frame(i + 1);
+        if (!frm || pixFormatToCode(frm.get_profile().format()) != VOCAB_PIXEL_MONO)
+        {
+            yCError(REALSENSE2) << "Missing infrared frame" << i + 1;
+            return false;
+        }
+        if (borrowedByOther || frm.get_stride_in_bytes() != frm.get_width())
+        {
+            // Padded rows cannot be wrapped, copy them
+            images[i]->resize(frm.get_width(), frm.get_height());
+            const auto* src = static_cast<const unsigned char*>(frm.get_data());
+            for (int row = 0; row < frm.get_height(); row++)
+            {
+                memcpy(images[i]->getRow(row), src + row * frm.get_stride_in_bytes(), frm.get_width());
+            }
+            continue;
+        }
+        // Borrow the librealsense buffer: the frame is kept alive until the next call of this consumer
+        m_zeroCopyInfraredFrames[i] = frm;
+        images[i]->setQuantum(1);
+        images[i]->setExternal(frm.get_data(), frm.get_width(), frm.get_height());
+    }
+    if (timeStamp != nullptr)
+    {
+        updateStamp(*timeStamp, data.get_infrared_frame(1));
+    }
+    return true;
 }
 
 int  realsense2Driver::height() const
@@ -1639,5 +3406,5 @@ int  realsense2Driver::height() const
 
 int  realsense2Driver::width() const
 {
-    return m_infrared_intrin.width*2;
+    return m_infrared_intrin.width * m_infraredStreams;
 }
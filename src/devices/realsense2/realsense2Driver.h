@@ -12,7 +12,13 @@
 #include <iostream>
 #include <cstring>
 #include <map>
+#include <memory>
 #include <mutex>
+#include <atomic>
+#include <tuple>
+#include <condition_variable>
+#include <chrono>
+#include <thread>
 
 #include <yarp/dev/DeviceDriver.h>
 #include <yarp/dev/IFrameGrabberControls.h>
@@ -20,20 +26,29 @@
 #include <yarp/os/PeriodicThread.h>
 #include <yarp/sig/all.h>
 #include <yarp/sig/Matrix.h>
+#include <yarp/sig/PointCloud.h>
 #include <yarp/os/Stamp.h>
 #include <yarp/dev/IRGBDSensor.h>
 #include <yarp/dev/RGBDSensorParamParser.h>
 #include <librealsense2/rs.hpp>
 
+#include "realsense2Context.h"
+#include "realsense2Statistics.h"
+#include "realsense2Sync.h"
+#include "realsense2Utils.h"
+#include "realsense2WorkerPool.h"
+
 
 class realsense2Driver :
         public yarp::dev::DeviceDriver,
         public yarp::dev::IFrameGrabberControls,
         public yarp::dev::IFrameGrabberImageRaw,
-        public yarp::dev::IRGBDSensor
+        public yarp::dev::IRGBDSensor,
+        public yarp::os::PeriodicThread
 {
 private:
     typedef yarp::sig::ImageOf<yarp::sig::PixelFloat> depthImage;
+    typedef yarp::sig::ImageOf<yarp::sig::PixelMono16> depthImageRaw;
     typedef yarp::os::Stamp                           Stamp;
     typedef yarp::os::Property                        Property;
     typedef yarp::sig::FlexImage                      FlexImage;
@@ -78,6 +93,42 @@ public:
     bool   getDepthImage(depthImage& depthImage, Stamp* timeStamp = nullptr) override;
     bool   getImages(FlexImage& colorFrame, depthImage& depthFrame, Stamp* colorStamp=NULL, Stamp* depthStamp=NULL) override;
 
+    // The methods below are not part of a yarp interface: the wrappers and the remote clients cannot reach them,
+    // they are only available to code opening the device in the same process.
+
+    // Native depth, in sensor units: multiply by getDepthScale() to obtain meters
+    bool   getDepthImage(depthImageRaw& depthImage, Stamp* timeStamp = nullptr);
+    bool   getImages(FlexImage& colorFrame, depthImageRaw& depthFrame, Stamp* colorStamp=nullptr, Stamp* depthStamp=nullptr);
+    double getDepthScale() const;
+
+    // Organized point cloud of the depth frame, in meters in the depth optical frame (not affected by rotateImage).
+    // The colored variant takes the colors from the color frame aligned to the depth one.
+    bool   getPointCloud(yarp::sig::PointCloud<yarp::sig::DataXYZ>& cloud, Stamp* timeStamp = nullptr);
+    bool   getPointCloud(yarp::sig::PointCloud<yarp::sig::DataXYZRGBA>& cloud, Stamp* timeStamp = nullptr);
+
+    // Number of depth frames never delivered since open(), dropped by the `latest` frame policy or by a full frame queue
+    unsigned long long getDroppedFrames() const;
+
+    // Depth compression (`depthCompression`): the Z16 depth delivered by getDepthImage(depthImageRaw&) encoded with
+    // realsense2Utils::encodeRvl(), after the post-processing and the alignment. With `QUANT_PARAM` the coded samples
+    // are the quantization steps, and step / 10^depth_quant is exactly the quantized float depth.
+    // getCompressedDepthScale() returns the meters of a coded unit.
+    bool   getCompressedDepthImage(std::vector<unsigned char>& data, int& width, int& height, Stamp* timeStamp = nullptr);
+    double getCompressedDepthScale() const;
+
+    // Stereo mode: left and right infrared images pointing to the librealsense buffers, valid until the next call
+    // from the same thread. The other threads calling meanwhile receive a copy.
+    // With a single infrared stream only the left image is delivered.
+    bool   getInfraredImages(yarp::sig::ImageOf<yarp::sig::PixelMono>& left, yarp::sig::ImageOf<yarp::sig::PixelMono>& right, Stamp* timeStamp = nullptr);
+
+    // Hardware synchronization (`syncGroup`): the newest set of matching depth frames of the group, one per member with
+    // its timestamp and frame number, and the skew of each member
+    bool   getMatchedSyncSet(std::map<std::string, realsense2SyncFrame>& set) const;
+    bool   getSyncStatistics(std::map<std::string, realsense2SyncStatistics>& statistics) const;
+
+    // Durations of the processing stages since the last periodic report (`statisticsPeriod`), and the rate of each stream
+    std::vector<realsense2StageStatistics> getStageStatistics(std::vector<double>& framerates) const;
+
     RGBDSensor_status     getSensorStatus() override;
     std::string getLastErrorMsg(Stamp* timeStamp = NULL) override;
 
@@ -103,40 +154,246 @@ public:
     int height() const override;
     int width() const override;
 
+    //PeriodicThread
+    void run() override;
+
 protected:
+    // Called by the watchdog, with the device mutex locked, once the pipeline streams again after a reconnection
+    virtual void deviceReconnected() {}
+    // Joins the watchdog, so that no reconnection runs anymore; called first by close()
+    void stopWatchdog();
+
+    // Cached state of a sensor option
+    struct optionInfo
+    {
+        bool              supported{false};
+        bool              hasRange{false};
+        rs2::option_range range{};
+        bool              hasValue{false};
+        float             value{0.0f};
+    };
+
+    // Requested configuration of the streams, sizes are in sensor coordinates
+    struct streamSettings
+    {
+        int rgbWidth{0};
+        int rgbHeight{0};
+        int depthWidth{0};
+        int depthHeight{0};
+        int rgbFps{0};
+        int depthFps{0};
+    };
+
     //method
-    inline bool initializeRealsenseDevice();
+    inline bool initializeRealsenseDevice(const streamSettings& settings);
     inline bool setParams();
 
+    // Updates the lazy streams, then waits for the frameset without the device mutex, and returns it locked
+    std::unique_lock<std::mutex> acquireFrameset(unsigned int streams, rs2::frameset& data);
+    bool        getFrameset(rs2::frameset& data, unsigned long long& sequence) const;
+    bool        waitForFrameset(rs2::frameset& data, unsigned int timeoutMs) const;
     bool        getImage(FlexImage& Frame, Stamp* timeStamp, rs2::frameset& sourceFrame);
     bool        getImage(depthImage& Frame, Stamp* timeStamp, const rs2::frameset& sourceFrame);
-    void        updateTransformations();
+    bool        getImage(depthImageRaw& Frame, Stamp* timeStamp, const rs2::frameset& sourceFrame);
+    template <class T>
+    bool        deprojectFrame(yarp::sig::PointCloud<T>& cloud, Stamp* timeStamp, const rs2::depth_frame& depth_frm);
+    void        updateDepthRays();
+    void        updateDepthGeometry(const rs2::frameset& data);
+    void        convertDepth(const uint16_t* src, float* dst, size_t count);
+    bool        quantizedCompression() const;
+    void        encodeDepth(const rs2::depth_frame& depth, std::vector<uint16_t>& scratch, std::vector<unsigned char>& encoded) const;
+    bool        updateTransformations();
+    void        alignFrameset(rs2::frameset& data);
+    void        filterFrameset(rs2::frameset& data) const;
+    bool        composeFrameset(rs2::frameset& data) const;
+    void        updateStamp(Stamp& stamp, const rs2::frame& frame) const;
+    void        reportSyncFrame(const rs2::frameset& data) const;
+    void        reportStatistics() const;
+    std::unique_lock<std::mutex> lockDevice() const;
+    bool        setupPostProcessing(const yarp::os::Searchable& cfg);
     bool        pipelineStartup();
     bool        pipelineShutdown();
     bool        pipelineRestart();
+    bool        requestStreams(unsigned int streams);
+    std::string activeStreamsDescription() const;
+    // Interrupts the wait for frames in progress and locks m_acquisitionMutex, for a restart of the pipeline
+    std::unique_lock<std::mutex> interruptAcquisition();
+    void        discardFrames();
+    void        watchdogLoop();
+    bool        isStalled() const;
+    bool        reconnectDevice();
+    void        restoreOptions();
     bool        setFramerate(const int _fps);
-    void        fallback();
+    bool        setFramerates(const int rgbFps, const int depthFps);
+    bool        parseStreamSettings(streamSettings& settings);
+    void        enableStreams(const streamSettings& settings);
+    bool        applyStreamSettings(const streamSettings& settings);
+    void        buildProfileTable();
+    void        buildOptionCache();
+    bool        setOption(rs2_option option, const rs2::sensor* sensor, float value);
+    bool        getOption(rs2_option option, const rs2::sensor* sensor, float& value);
+    optionInfo* findOption(rs2_option option, const rs2::sensor* sensor);
+    bool        isAutoControlled(rs2_option option, const rs2::sensor* sensor);
+    bool        getOptionRange(rs2_option option, const rs2::sensor* sensor, rs2::option_range& range);
+    bool        optionPerc2Value(rs2_option option, const rs2::sensor* sensor, const float& perc, float& value);
+    bool        optionValue2Perc(rs2_option option, const rs2::sensor* sensor, float& perc, const float& value);
+    bool        isSupportedProfile(rs2_stream stream, rs2_format format, int width, int height, int fps) const;
+    void        warmup();
 
 
     // realsense classes
     mutable std::mutex m_mutex;
-    rs2::context m_ctx;
     rs2::config m_cfg;
     rs2::pipeline m_pipeline;
     rs2::pipeline_profile m_profile;
     rs2::device  m_device;
+    // Serial number requested with the `serial` parameter, and the one of the device acquired
+    std::string  m_serial;
+    std::string  m_acquiredSerial;
+    // Recording opened instead of a connected device, see the `playbackFile` parameter
+    std::string  m_playbackFile;
     std::vector<rs2::sensor> m_sensors;
     rs2::sensor* m_depth_sensor;
     rs2::sensor* m_color_sensor;
+    // Stream profiles of all the sensors, keyed by (stream, format, width, height, fps)
+    typedef std::tuple<rs2_stream, rs2_format, int, int, int> profileKey;
+    std::map<profileKey, rs2::stream_profile> m_profiles;
+    // Options of all the sensors, guarded by m_optionMutex. Values are served from the cache only
+    // with m_cacheOptionValues, and never for options under automatic control.
+    std::map<std::pair<const rs2::sensor*, rs2_option>, optionInfo> m_options;
+    std::mutex m_optionMutex;
+    bool m_cacheOptionValues{false};
     rs2_intrinsics m_depth_intrin{}, m_color_intrin{}, m_infrared_intrin{};
     rs2_extrinsics m_depth_to_color{}, m_color_to_depth{};
     rs2_stream  m_alignment_stream{RS2_STREAM_COLOR};
+    std::unique_ptr<rs2::align> m_alignToColor;
+    std::unique_ptr<rs2::align> m_alignToDepth;
+    // Depth post-processing blocks, applied in order to every acquired frameset
+    std::vector<std::shared_ptr<rs2::filter>> m_depthFilters;
+    // Magnitude of the decimation filter, and the profile of the processed depth frames the intrinsics come from
+    int m_depthDecimation{1};
+    int m_depthProfileId{-1};
+
+    // Optional frame queue filled by the pipeline callback; with the `latest` policy the readers drain it
+    // and keep only the newest frameset
+    enum frame_policy_enumtype {all_frames=0, latest_frame};
+    frame_policy_enumtype            m_framePolicy{all_frames};
+    unsigned int                     m_frameQueueSize{0};
+    std::unique_ptr<rs2::frame_queue> m_frameQueue;
+    mutable std::atomic<unsigned long long> m_droppedFrames{0};
+    mutable unsigned long long       m_lastDepthFrameNumber{0};
+
+    // Stage timings and stream rates, enabled and logged periodically by `statisticsPeriod`
+    mutable realsense2Statistics     m_statistics;
+    double                           m_statisticsPeriod{0.0};
+
+    // Newest frameset, published by the acquisition thread or by the getter that acquired it, guarded by m_frameMutex.
+    // It is shared by all the consumers (e.g. several wrappers of the same device): with the acquisition thread
+    // every getter receives the newest frameset without waiting, otherwise the getters calling while another one
+    // waits for the device receive the frameset it acquires.
+    bool                             m_asyncAcquisition{false};
+    mutable std::mutex               m_frameMutex;
+    mutable std::condition_variable  m_frameCondition;
+    mutable rs2::frameset            m_latestFrameset;
+    mutable bool                     m_hasLatestFrameset{false};
+    mutable unsigned long long       m_latestSequence{0};
+    // Serializes the waits for the device and the processing of the acquired framesets (getters or acquisition
+    // thread) with the restarts of the pipeline. Locked after m_mutex, never the other way around.
+    mutable std::mutex               m_acquisitionMutex;
+    std::atomic<bool>                m_abortWaits{false};
+
+    // Result of a conversion kept for the other consumers of the same frameset, guarded by m_mutex. It is used
+    // only while the framesets are converted more than once, so that a single consumer pays no extra copy.
+    template <class T>
+    struct conversionCache
+    {
+        std::vector<T>     data;
+        unsigned long long sequence{0};
+        unsigned int       uses{0};
+        bool               shared{false};
+        bool               valid{false};
+
+        // Registers a conversion of the frameset, returns true if it has to go through data,
+        // and sets cached if data already holds it
+        bool use(unsigned long long frameset, size_t count, bool& cached)
+        {
+            if (frameset != sequence)
+            {
+                shared = uses > 1;
+                sequence = frameset;
+                uses = 0;
+                valid = false;
+            }
+            shared |= ++uses > 1;
+            cached = shared && valid && data.size() == count;
+            if (shared && !cached)
+            {
+                data.resize(count);
+            }
+            return shared;
+        }
+    };
+    // Frameset delivered by the last acquireFrameset() and its calling thread, guarded by m_mutex, with the
+    // aligned version and the images of the frameset
+    unsigned long long               m_deliveredSequence{0};
+    std::thread::id                  m_consumer;
+    rs2::frameset                    m_alignedFrameset;
+    unsigned long long               m_alignedSequence{0};
+    conversionCache<unsigned char>   m_colorImageCache;
+    conversionCache<float>           m_depthImageCache;
+    // Compressed depth, encoded by the acquisition thread for the published frameset when possible
+    bool                             m_depthCompression{false};
+    std::shared_ptr<const std::vector<unsigned char>> m_latestCompressedDepth;
+    unsigned long long               m_compressedSequence{0};
+    std::vector<uint16_t>            m_compressionScratch;
+    std::vector<uint16_t>            m_acquisitionCompressionScratch;
+
+    // Lazy streams (`lazyStreams`): the streams not read for `lazyStreamsTimeout` seconds are paused, and
+    // started again by the first read. Masks of streamBit values, the active one is read by the acquisition thread.
+    enum streamBit { color_stream = 1, depth_stream = 2, infrared_stream = 4 };
+    bool                             m_lazyStreams{false};
+    double                           m_lazyStreamsTimeout{5.0};
+    unsigned int                     m_requestedStreams{0};
+    std::atomic<unsigned int>        m_activeStreams{0};
+    std::chrono::steady_clock::time_point m_lastRead[3];
+
+    // Watchdog (`watchdogTimeout`): a wait for frames lasting longer than the timeout, or the disconnection
+    // of the device, triggers the restart of the pipeline on the same device, as soon as it is connected again
+    double                           m_watchdogTimeout{0.0};
+    std::thread                      m_watchdog;
+    std::mutex                       m_watchdogMutex;
+    std::condition_variable          m_watchdogCondition;
+    bool                             m_watchdogStop{false};
+    std::atomic<bool>                m_reconnecting{false};
+    // Start of the first of the consecutive failed waits (steady clock ticks), 0 after a frameset is received
+    mutable std::atomic<long long>   m_waitStart{0};
+
+    // Startup warm-up, performed in open() or by the acquisition thread
+    int                              m_warmupFrames{30};
+    double                           m_warmupTimeout{0.0};
+    bool                             m_warmupInBackground{false};
+    int                              m_warmupPending{0};
+    std::chrono::steady_clock::time_point m_warmupDeadline;
 
+    // Independent framerates: latest frame of each stream (by profile id), guarded by m_frameMutex
+    bool                             m_independentStreams{false};
+    mutable std::map<int, rs2::frame> m_latestFrames;
+    std::unique_ptr<rs2::filter>     m_frameComposer;
 
     // Data quantization related parameters
     bool                             m_depthQuantizationEnabled{false};
     int                              m_depthDecimalNum{0};
+    float                            m_depthQuantCoeff{1.0f};
+    realsense2Utils::depthConversionFn m_depthConversion{nullptr};
 
+    enum timestamp_enumtype {yarp_timestamp=0, rs_timestamp};
+    timestamp_enumtype m_timestamp_type{yarp_timestamp};
+    // Inter camera synchronization: RS2_OPTION_INTER_CAM_SYNC_MODE value and frame matching group
+    int    m_syncMode{0};
+    std::string m_syncGroupName;
+    double m_syncTolerance{2.0};
+    std::shared_ptr<realsense2SyncGroup> m_syncGroup;
+    mutable unsigned long long m_lastSyncFrameNumber{0};
     yarp::os::Stamp m_rgb_stamp;
     yarp::os::Stamp m_depth_stamp;
     mutable std::string m_lastError;
@@ -145,9 +402,29 @@ protected:
     bool m_initialized;
     bool m_stereoMode;
     bool m_needAlignment;
-    int m_fps;
+    streamSettings m_streams;
     float m_scale;
-    bool m_rotateImage180{false};
+    int m_rotation{0};
+    std::vector<float> m_depthRotationBuffer;
+    // With processingThreads > 1 the color and depth images are processed concurrently, and the depth
+    // conversion is split in stripes
+    std::unique_ptr<realsense2WorkerPool> m_workerPool;
+    // Deprojection of every depth pixel at unit depth, rebuilt when the depth intrinsics change
+    std::vector<float> m_depthRayX;
+    std::vector<float> m_depthRayY;
+    bool m_zeroCopyRgb{false};
+    // Format of the color stream, and the host conversion of YUYV (RS2_FORMAT_ANY for none)
+    rs2_format m_rgbFormat{RS2_FORMAT_RGB8};
+    rs2_format m_yuyvConversion{RS2_FORMAT_ANY};
+    std::vector<unsigned char> m_colorConversionBuffer;
+    // Frames borrowed by the zero-copy images, released only by the next call of the consumer (calling thread)
+    // they were delivered to, so that the buffer of an image still in use is never released by another consumer
+    rs2::frame m_zeroCopyColorFrame;
+    std::thread::id m_zeroCopyColorOwner;
+    // Infrared streams of the stereo mode (`infraredStreams`), and the frames borrowed by getInfraredImages()
+    int        m_infraredStreams{2};
+    rs2::frame m_zeroCopyInfraredFrames[2];
+    std::thread::id m_zeroCopyInfraredOwner;
     std::vector<cameraFeature_id_t> m_supportedFeatures;
 };
 #endif
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2006-2020 Istituto Italiano di Tecnologia (IIT)
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms of the
+ * BSD-3-Clause license. See the accompanying LICENSE file for details.
+ */
+
+#include "realsense2ImuBuffer.h"
+
+// The sequence of slot i is 2i+1 while the sample is written and 2i+2 once it is complete.
+
+realsense2ImuBuffer::realsense2ImuBuffer(size_t capacity)
+{
+    reset(capacity);
+}
+
+void realsense2ImuBuffer::reset(size_t capacity)
+{
+    size_t size = 1;
+    while (size < capacity)
+    {
+        size <<= 1;
+    }
+    m_slots.reset(new slot[size]);
+    m_mask = size - 1;
+    m_head.store(0, std::memory_order_relaxed);
+}
+
+size_t realsense2ImuBuffer::capacity() const
+{
+    return m_mask + 1;
+}
+
+uint64_t realsense2ImuBuffer::head() const
+{
+    return m_head.load(std::memory_order_acquire);
+}
+
+void realsense2ImuBuffer::push(const realsense2ImuSample& sample)
+{
+    uint64_t index = m_head.load(std::memory_order_relaxed);
+    slot& s = m_slots[index & m_mask];
+    s.sequence.store(2 * index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    s.sample = sample;
+    s.sequence.store(2 * index + 2, std::memory_order_release);
+    m_head.store(index + 1, std::memory_order_release);
+}
+
+bool realsense2ImuBuffer::readSlot(uint64_t index, realsense2ImuSample& sample) const
+{
+    const slot& s = m_slots[index & m_mask];
+    uint64_t before = s.sequence.load(std::memory_order_acquire);
+    if (before != 2 * index + 2)
+    {
+        return false;
+    }
+    sample = s.sample;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return s.sequence.load(std::memory_order_relaxed) == before;
+}
+
+bool realsense2ImuBuffer::latest(realsense2ImuSample& sample) const
+{
+    uint64_t head = m_head.load(std::memory_order_acquire);
+    while (head > 0)
+    {
+        if (readSlot(head - 1, sample))
+        {
+            return true;
+        }
+        // The producer lapped the whole buffer while copying, try again with the new head
+        head = m_head.load(std::memory_order_acquire);
+    }
+    return false;
+}
+
+size_t realsense2ImuBuffer::read(uint64_t& cursor, std::vector<realsense2ImuSample>& samples) const
+{
+    uint64_t head = m_head.load(std::memory_order_acquire);
+    size_t lost = 0;
+    if (cursor > head)
+    {
+        cursor = head;
+    }
+    if (head - cursor > capacity())
+    {
+        lost += static_cast<size_t>(head - cursor - capacity());
+        cursor = head - capacity();
+    }
+
+    samples.reserve(samples.size() + static_cast<size_t>(head - cursor));
+    realsense2ImuSample sample;
+    for (; cursor < head; cursor++)
+    {
+        if (readSlot(cursor, sample))
+        {
+            samples.push_back(sample);
+        }
+        else
+        {
+            lost++;
+        }
+    }
+    return lost;
+}
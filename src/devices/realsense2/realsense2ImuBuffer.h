@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2006-2020 Istituto Italiano di Tecnologia (IIT)
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms of the
+ * BSD-3-Clause license. See the accompanying LICENSE file for details.
+ */
+
+#ifndef REALSENSE2_IMU_BUFFER_H
+#define REALSENSE2_IMU_BUFFER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/**
+ * A three axis sample of the motion sensor.
+ * `timestamp` is the stamp delivered to the users (seconds), `frameTimestamp`
+ * the librealsense frame timestamp (milliseconds) used to integrate the samples.
+ */
+struct realsense2ImuSample
+{
+    double timestamp{0.0};
+    double frameTimestamp{0.0};
+    float  x{0.0f};
+    float  y{0.0f};
+    float  z{0.0f};
+};
+
+/**
+ * Ring buffer of IMU samples with a single producer, the sensor callback, which never blocks.
+ * Readers never block the producer either: each slot is protected by a sequence number and
+ * a sample overwritten while it is being copied is discarded.
+ * Batch readers keep their position in a cursor, the index of the next sample to read.
+ */
+class realsense2ImuBuffer
+{
+public:
+    explicit realsense2ImuBuffer(size_t capacity = 1024);
+
+    /**
+     * Reallocates the buffer, the capacity is rounded up to a power of two.
+     * Not thread safe: call it while the producer is stopped.
+     */
+    void reset(size_t capacity);
+
+    size_t   capacity() const;
+    uint64_t head() const;
+
+    void push(const realsense2ImuSample& sample);
+
+    /**
+     * Copies the newest sample.
+     * @return false if no sample was received yet
+     */
+    bool latest(realsense2ImuSample& sample) const;
+
+    /**
+     * Appends to `samples` all the samples from `cursor` on, and moves the cursor after the newest one.
+     * @return the number of samples lost because they were overwritten before being read
+     */
+    size_t read(uint64_t& cursor, std::vector<realsense2ImuSample>& samples) const;
+
+private:
+    struct slot
+    {
+        std::atomic<uint64_t> sequence{0};
+        realsense2ImuSample   sample;
+    };
+
+    bool readSlot(uint64_t index, realsense2ImuSample& sample) const;
+
+    std::unique_ptr<slot[]> m_slots;
+    size_t                  m_mask{0};
+    std::atomic<uint64_t>   m_head{0};
+};
+
+#endif
@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2006-2020 Istituto Italiano di Tecnologia (IIT)
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms of the
+ * BSD-3-Clause license. See the accompanying LICENSE file for details.
+ */
+
+#include "realsense2Statistics.h"
+
+namespace {
+const char* const stageNames[] = { "wait", "align", "postProcess", "colorConvert", "depthConvert", "lockWait" };
+
+int64_t ticks(realsense2Statistics::clock::time_point t)
+{
+    return static_cast<int64_t>(t.time_since_epoch().count());
+}
+
+uint64_t take(std::atomic<uint64_t>& counter, bool reset)
+{
+    return reset ? counter.exchange(0, std::memory_order_relaxed) : counter.load(std::memory_order_relaxed);
+}
+}
+
+realsense2Statistics::realsense2Statistics()
+{
+    for (auto& stage : m_stages)
+    {
+        for (auto& b : stage.bucket)
+        {
+            b.store(0, std::memory_order_relaxed);
+        }
+        stage.samples.store(0, std::memory_order_relaxed);
+        stage.sum.store(0, std::memory_order_relaxed);
+        stage.max.store(0, std::memory_order_relaxed);
+    }
+    for (auto& frames : m_frames)
+    {
+        frames.store(0, std::memory_order_relaxed);
+    }
+    m_since.store(ticks(clock::now()), std::memory_order_relaxed);
+    m_lastReport.store(m_since.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+void realsense2Statistics::setEnabled(bool enabled)
+{
+    m_enabled = enabled;
+    m_since.store(ticks(clock::now()), std::memory_order_relaxed);
+    m_lastReport.store(m_since.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+bool realsense2Statistics::enabled() const
+{
+    return m_enabled;
+}
+
+realsense2Statistics::clock::time_point realsense2Statistics::now() const
+{
+    return m_enabled ? clock::now() : clock::time_point();
+}
+
+void realsense2Statistics::record(realsense2Stage stage, clock::time_point start)
+{
+    if (!m_enabled)
+    {
+        return;
+    }
+    uint64_t us = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - start).count());
+
+    // Bucket b counts the durations in [2^(b-1), 2^b) microseconds, the last one everything longer
+    size_t b = 0;
+    while (b < buckets - 1 && (us >> b) != 0)
+    {
+        b++;
+    }
+    histogram& h = m_stages[static_cast<size_t>(stage)];
+    h.bucket[b].fetch_add(1, std::memory_order_relaxed);
+    h.samples.fetch_add(1, std::memory_order_relaxed);
+    h.sum.fetch_add(us, std::memory_order_relaxed);
+    uint64_t max = h.max.load(std::memory_order_relaxed);
+    while (us > max && !h.max.compare_exchange_weak(max, us, std::memory_order_relaxed)) {}
+}
+
+void realsense2Statistics::countFrame(realsense2StatisticsStream stream)
+{
+    if (m_enabled)
+    {
+        m_frames[static_cast<size_t>(stream)].fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+std::vector<realsense2StageStatistics> realsense2Statistics::summary(std::vector<double>& framerates, bool reset)
+{
+    // The counters are read one by one while the stages are recorded, a summary may be off by the samples in flight
+    std::vector<realsense2StageStatistics> stages;
+    for (size_t s = 0; s < static_cast<size_t>(realsense2Stage::count); s++)
+    {
+        histogram& h = m_stages[s];
+        realsense2StageStatistics stage;
+        stage.name = stageNames[s];
+
+        uint64_t counts[buckets];
+        uint64_t total = 0;
+        for (size_t b = 0; b < buckets; b++)
+        {
+            counts[b] = take(h.bucket[b], reset);
+            total += counts[b];
+        }
+        stage.samples = take(h.samples, reset);
+        uint64_t sum = take(h.sum, reset);
+        stage.max = take(h.max, reset);
+        stage.mean = stage.samples > 0 ? static_cast<double>(sum) / stage.samples : 0.0;
+
+        uint64_t cumulative = 0;
+        for (size_t b = 0; b < buckets && total > 0; b++)
+        {
+            cumulative += counts[b];
+            uint64_t bound = b == 0 ? 0 : (uint64_t{1} << b) - 1;
+            if (stage.p50 == 0 && cumulative * 2 >= total)
+            {
+                stage.p50 = bound;
+            }
+            if (cumulative * 100 >= total * 99)
+            {
+                stage.p99 = bound;
+                break;
+            }
+        }
+        stages.push_back(stage);
+    }
+
+    int64_t now = ticks(clock::now());
+    int64_t since = reset ? m_since.exchange(now, std::memory_order_relaxed) : m_since.load(std::memory_order_relaxed);
+    double elapsed = std::chrono::duration<double>(clock::duration(now - since)).count();
+    framerates.clear();
+    for (auto& frames : m_frames)
+    {
+        uint64_t count = take(frames, reset);
+        framerates.push_back(elapsed > 0.0 ? count / elapsed : 0.0);
+    }
+    return stages;
+}
+
+bool realsense2Statistics::reportDue(double period)
+{
+    if (!m_enabled || period <= 0.0)
+    {
+        return false;
+    }
+    int64_t now = ticks(clock::now());
+    int64_t last = m_lastReport.load(std::memory_order_relaxed);
+    auto periodTicks = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(period)).count();
+    if (now - last < periodTicks)
+    {
+        return false;
+    }
+    return m_lastReport.compare_exchange_strong(last, now, std::memory_order_relaxed);
+}
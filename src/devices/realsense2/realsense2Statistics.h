@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2006-2020 Istituto Italiano di Tecnologia (IIT)
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms of the
+ * BSD-3-Clause license. See the accompanying LICENSE file for details.
+ */
+
+#ifndef REALSENSE2_STATISTICS_H
+#define REALSENSE2_STATISTICS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Processing stages of a frameset, from the wait for the pipeline to the copy in the yarp images.
+ */
+enum class realsense2Stage
+{
+    wait,
+    align,
+    postProcess,
+    colorConvert,
+    depthConvert,
+    lockWait,
+    count
+};
+
+enum class realsense2StatisticsStream
+{
+    color,
+    depth,
+    infrared,
+    count
+};
+
+/**
+ * Durations of a stage in microseconds. The percentiles are the upper bounds of the power of two
+ * buckets of the histogram, so they overestimate the real value by at most a factor of two.
+ */
+struct realsense2StageStatistics
+{
+    std::string name;
+    uint64_t    samples{0};
+    double      mean{0.0};
+    uint64_t    p50{0};
+    uint64_t    p99{0};
+    uint64_t    max{0};
+};
+
+/**
+ * Always-on counters of the driver: a histogram per stage and the frames received per stream.
+ * Recording is lock free (relaxed atomics only) and is a no-op while disabled, so that a stage can be
+ * timed from any thread, the acquisition and the worker ones included.
+ */
+class realsense2Statistics
+{
+public:
+    typedef std::chrono::steady_clock clock;
+
+    realsense2Statistics();
+
+    void setEnabled(bool enabled);
+    bool enabled() const;
+
+    /**
+     * Start of a stage, to be passed to record(). Does not read the clock while disabled.
+     */
+    clock::time_point now() const;
+    void record(realsense2Stage stage, clock::time_point start);
+    void countFrame(realsense2StatisticsStream stream);
+
+    /**
+     * Statistics since the previous reset, and the rate of each stream (frames per second).
+     * @param reset restart all the counters, e.g. for a periodic report
+     */
+    std::vector<realsense2StageStatistics> summary(std::vector<double>& framerates, bool reset);
+
+    /**
+     * @return true once per period, to the first caller after its expiration
+     */
+    bool reportDue(double period);
+
+    /**
+     * Records the lifetime of the object as a sample of the stage.
+     */
+    class scope
+    {
+    public:
+        scope(realsense2Statistics& statistics, realsense2Stage stage) :
+            m_statistics(statistics), m_stage(stage), m_start(statistics.now()) {}
+        ~scope() { m_statistics.record(m_stage, m_start); }
+
+        scope(const scope&) = delete;
+        scope& operator=(const scope&) = delete;
+
+    private:
+        realsense2Statistics& m_statistics;
+        realsense2Stage       m_stage;
+        clock::time_point     m_start;
+    };
+
+private:
+    static constexpr size_t buckets = 24;
+
+    struct histogram
+    {
+        std::atomic<uint64_t> bucket[buckets];
+        std::atomic<uint64_t> samples;
+        std::atomic<uint64_t> sum;
+        std::atomic<uint64_t> max;
+    };
+
+    bool                     m_enabled{false};
+    histogram                m_stages[static_cast<size_t>(realsense2Stage::count)];
+    std::atomic<uint64_t>    m_frames[static_cast<size_t>(realsense2StatisticsStream::count)];
+    std::atomic<int64_t>     m_since;
+    std::atomic<int64_t>     m_lastReport;
+};
+
+#endif
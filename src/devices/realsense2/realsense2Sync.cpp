@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2006-2020 Istituto Italiano di Tecnologia (IIT)
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms of the
+ * BSD-3-Clause license. See the accompanying LICENSE file for details.
+ */
+
+#include "realsense2Sync.h"
+
+#include <cmath>
+
+namespace {
+// Frames kept per member, enough to cover the delivery delays between the devices
+constexpr size_t historySize = 16;
+// Newest frames of each member holding their depth data, the older ones keep only the timestamp
+constexpr size_t framesKept = 4;
+}
+
+std::shared_ptr<realsense2SyncGroup> realsense2SyncGroup::get(const std::string& name)
+{
+    static std::mutex groupsMutex;
+    static std::map<std::string, std::weak_ptr<realsense2SyncGroup>> groups;
+
+    std::lock_guard<std::mutex> guard(groupsMutex);
+    auto group = groups[name].lock();
+    if (!group)
+    {
+        group = std::make_shared<realsense2SyncGroup>();
+        groups[name] = group;
+    }
+    return group;
+}
+
+void realsense2SyncGroup::join(const std::string& serial, bool reference, double tolerance)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    member& m = m_members[serial];
+    m.history.assign(historySize, realsense2SyncFrame());
+    m.next = 0;
+    m.count = 0;
+    m.statistics = realsense2SyncStatistics();
+    if (reference || m_reference.empty())
+    {
+        m_reference = serial;
+    }
+    m_tolerance = tolerance;
+}
+
+void realsense2SyncGroup::leave(const std::string& serial)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    m_members.erase(serial);
+    if (m_reference == serial)
+    {
+        m_reference = m_members.empty() ? std::string() : m_members.begin()->first;
+    }
+}
+
+void realsense2SyncGroup::report(const std::string& serial, const rs2::depth_frame& depth)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    auto it = m_members.find(serial);
+    if (it == m_members.end())
+    {
+        return;
+    }
+    member& m = it->second;
+    if (serial == m_reference && m.count == historySize)
+    {
+        // The oldest reference frame is about to be overwritten, all the members had the time to report its matches
+        account(m.history[m.next]);
+    }
+    m.history[m.next].timestamp = depth.get_timestamp();
+    m.history[m.next].frameNumber = depth.get_frame_number();
+    m.history[m.next].depth = depth;
+    m.history[(m.next + historySize - framesKept) % historySize].depth = rs2::frame();
+    m.next = (m.next + 1) % historySize;
+    if (m.count < historySize)
+    {
+        m.count++;
+    }
+}
+
+bool realsense2SyncGroup::closest(const member& m, double timestamp, bool withDepth, realsense2SyncFrame& frame) const
+{
+    double best = m_tolerance;
+    bool found = false;
+    for (size_t i = 0; i < m.count; i++)
+    {
+        if (withDepth && !m.history[i].depth)
+        {
+            continue;
+        }
+        double skew = std::fabs(m.history[i].timestamp - timestamp);
+        if (skew <= best)
+        {
+            best = skew;
+            frame = m.history[i];
+            found = true;
+        }
+    }
+    return found;
+}
+
+void realsense2SyncGroup::account(const realsense2SyncFrame& reference)
+{
+    for (auto& entry : m_members)
+    {
+        if (entry.first == m_reference)
+        {
+            continue;
+        }
+        realsense2SyncStatistics& s = entry.second.statistics;
+        realsense2SyncFrame frame;
+        if (!closest(entry.second, reference.timestamp, false, frame))
+        {
+            s.unmatched++;
+            continue;
+        }
+        s.lastSkew = frame.timestamp - reference.timestamp;
+        s.matched++;
+        s.meanSkew += (s.lastSkew - s.meanSkew) / s.matched;
+        s.maxSkew = std::fmax(s.maxSkew, std::fabs(s.lastSkew));
+    }
+}
+
+bool realsense2SyncGroup::getMatchedSet(std::map<std::string, realsense2SyncFrame>& set) const
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    auto reference = m_members.find(m_reference);
+    if (reference == m_members.end())
+    {
+        return false;
+    }
+    const member& r = reference->second;
+    // From the newest reference frame to the oldest one still holding its depth
+    for (size_t n = 1; n <= r.count && n <= framesKept; n++)
+    {
+        const realsense2SyncFrame& candidate = r.history[(r.next + historySize - n) % historySize];
+        set.clear();
+        bool complete = true;
+        for (const auto& entry : m_members)
+        {
+            realsense2SyncFrame frame;
+            if (!closest(entry.second, candidate.timestamp, true, frame))
+            {
+                complete = false;
+                break;
+            }
+            set[entry.first] = frame;
+        }
+        if (complete)
+        {
+            return true;
+        }
+    }
+    set.clear();
+    return false;
+}
+
+std::map<std::string, realsense2SyncStatistics> realsense2SyncGroup::getStatistics() const
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    std::map<std::string, realsense2SyncStatistics> statistics;
+    for (const auto& entry : m_members)
+    {
+        statistics[entry.first] = entry.second.statistics;
+    }
+    return statistics;
+}
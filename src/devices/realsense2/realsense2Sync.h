@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2006-2020 Istituto Italiano di Tecnologia (IIT)
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms of the
+ * BSD-3-Clause license. See the accompanying LICENSE file for details.
+ */
+
+#ifndef REALSENSE2_SYNC_H
+#define REALSENSE2_SYNC_H
+
+#include <librealsense2/rs.hpp>
+
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * A depth frame reported to a synchronization group: the timestamp (milliseconds, global time
+ * domain) is used for the matching, the frame number is the stamp count of the delivered images
+ * when the `realsense` timestamps are used. The Z16 frame, after the post-processing, is kept only
+ * for the newest frames of each member, so that the librealsense frame pools are not exhausted.
+ */
+struct realsense2SyncFrame
+{
+    double             timestamp{0.0};
+    unsigned long long frameNumber{0};
+    rs2::frame         depth;
+};
+
+/**
+ * Skew of the frames of a device with respect to the matching frames of the reference device,
+ * in milliseconds. A frame without a match within the tolerance is counted as unmatched.
+ */
+struct realsense2SyncStatistics
+{
+    size_t matched{0};
+    size_t unmatched{0};
+    double lastSkew{0.0};
+    double meanSkew{0.0};
+    double maxSkew{0.0};
+};
+
+/**
+ * Devices of the same process capturing in hardware synchronization. Every member reports its depth
+ * frames; the frames of the reference device (the master, or the first member otherwise) are
+ * matched with the closest frame of each other member within the tolerance.
+ * The statistics of a reference frame are accounted when it leaves the history, after all the
+ * members had the time to report the frames of the same instant.
+ */
+class realsense2SyncGroup
+{
+public:
+    /**
+     * Returns the group with the given name, created on first use.
+     */
+    static std::shared_ptr<realsense2SyncGroup> get(const std::string& name);
+
+    void join(const std::string& serial, bool reference, double tolerance);
+    void leave(const std::string& serial);
+    void report(const std::string& serial, const rs2::depth_frame& depth);
+
+    /**
+     * Finds the newest set of frames, one per member, within the tolerance from a reference frame,
+     * among the frames still holding their depth data.
+     * @return false if no complete set is in the history
+     */
+    bool getMatchedSet(std::map<std::string, realsense2SyncFrame>& set) const;
+
+    std::map<std::string, realsense2SyncStatistics> getStatistics() const;
+
+private:
+    struct member
+    {
+        std::vector<realsense2SyncFrame> history;
+        size_t                           next{0};
+        size_t                           count{0};
+        realsense2SyncStatistics         statistics;
+    };
+
+    // Must be called with the mutex locked
+    bool closest(const member& m, double timestamp, bool withDepth, realsense2SyncFrame& frame) const;
+    void account(const realsense2SyncFrame& reference);
+
+    mutable std::mutex                m_mutex;
+    std::map<std::string, member>     m_members;
+    std::string                       m_reference;
+    double                            m_tolerance{2.0};
+};
+
+#endif
@@ -9,6 +9,7 @@
 #include "realsense2Tracking.h"
 
 #include <yarp/os/LogComponent.h>
+#include <yarp/os/Time.h>
 #include <yarp/os/Value.h>
 
 #include <yarp/sig/ImageUtils.h>
@@ -72,6 +73,42 @@ struct float3 {
 
 //---------------------------------------------------------------
 
+namespace {
+// Constant acceleration extrapolation of the pose by dt seconds, as in the librealsense pose-predict example
+rs2_pose predictPose(const rs2_pose& pose, float dt)
+{
+    rs2_pose predicted = pose;
+    const float dt2 = dt * dt / 2;
+    predicted.translation.x = pose.translation.x + dt * pose.velocity.x + dt2 * pose.acceleration.x;
+    predicted.translation.y = pose.translation.y + dt * pose.velocity.y + dt2 * pose.acceleration.y;
+    predicted.translation.z = pose.translation.z + dt * pose.velocity.z + dt2 * pose.acceleration.z;
+
+    // Half of the rotation vector, the quaternion of the rotation is its exponential
+    float wx = dt / 2 * (pose.angular_velocity.x + dt * pose.angular_acceleration.x / 2);
+    float wy = dt / 2 * (pose.angular_velocity.y + dt * pose.angular_acceleration.y / 2);
+    float wz = dt / 2 * (pose.angular_velocity.z + dt * pose.angular_acceleration.z / 2);
+    float theta = std::sqrt(wx * wx + wy * wy + wz * wz);
+    float k = theta > 1e-6f ? std::sin(theta) / theta : 1.0f;
+    rs2_quaternion dq{k * wx, k * wy, k * wz, std::cos(theta)};
+    const rs2_quaternion& q = pose.rotation;
+    predicted.rotation.x = dq.w * q.x + dq.x * q.w + dq.y * q.z - dq.z * q.y;
+    predicted.rotation.y = dq.w * q.y - dq.x * q.z + dq.y * q.w + dq.z * q.x;
+    predicted.rotation.z = dq.w * q.z + dq.x * q.y - dq.y * q.x + dq.z * q.w;
+    predicted.rotation.w = dq.w * q.w - dq.x * q.x - dq.y * q.y - dq.z * q.z;
+    return predicted;
+}
+
+void poseToRpy(const rs2_pose& pose, double rpy[3])
+{
+    yarp::math::Quaternion q(pose.rotation.x, pose.rotation.y, pose.rotation.z, pose.rotation.w);
+    yarp::sig::Matrix mat = q.toRotationMatrix3x3();
+    yarp::sig::Vector rpy_temp = yarp::math::dcm2rpy(mat);
+    rpy[0] = 0 + rpy_temp[0] * 180 / M_PI; //here we can eventually adjust the sign and/or sum an offset
+    rpy[1] = 0 + rpy_temp[1] * 180 / M_PI;
+    rpy[2] = 0 + rpy_temp[2] * 180 / M_PI;
+}
+} // namespace
+
 #if 0
 static std::string get_device_information(const rs2::device& dev)
 {
@@ -147,14 +184,16 @@ static void settingErrorMsg(const string& error, bool& ret)
 }
 #endif
 
-realsense2Tracking::realsense2Tracking()
+realsense2Tracking::realsense2Tracking() :
+    m_pipeline(realsense2Context::sharedContext())
 {
 }
 
 bool realsense2Tracking::pipelineStartup()
 {
     try {
-        m_profile = m_pipeline.start(m_cfg);
+        // The frames are delivered to the callback, so that the getters never wait for the device
+        m_profile = m_pipeline.start(m_cfg, [this](rs2::frame frame) { onFrame(frame); });
     } catch (const rs2::error& e) {
         yCError(REALSENSE2TRACKING) << "Failed to start the pipeline:"
                  << "(" << e.what() << ")";
@@ -177,6 +216,120 @@ bool realsense2Tracking::pipelineShutdown()
     return true;
 }
 
+void realsense2Tracking::onFrame(const rs2::frame& frame)
+{
+    if (auto frameset = frame.as<rs2::frameset>())
+    {
+        for (size_t i = 0; i < frameset.size(); i++)
+        {
+            storeFrame(frameset[i]);
+        }
+    }
+    else
+    {
+        storeFrame(frame);
+    }
+}
+
+void realsense2Tracking::storeFrame(const rs2::frame& frame)
+{
+    double timestamp = (m_timestamp_type == rs_timestamp) ? frame.get_timestamp() : yarp::os::Time::now();
+    rs2_stream stream = frame.get_profile().stream_type();
+    if (stream == RS2_STREAM_POSE)
+    {
+        rs2_pose pose = frame.as<rs2::pose_frame>().get_pose_data();
+        // Converted here once, so that the getters only copy it
+        double rpy[3];
+        poseToRpy(pose, rpy);
+        double arrival = yarp::os::Time::now();
+        std::lock_guard<std::mutex> guard(m_snapshotMutex);
+        m_snapshot.pose = pose;
+        std::copy(rpy, rpy + 3, m_snapshot.rpy);
+        m_snapshot.poseArrival = arrival;
+        m_snapshot.poseTimestamp = timestamp;
+        m_snapshot.hasPose = true;
+    }
+    else if (stream == RS2_STREAM_GYRO || stream == RS2_STREAM_ACCEL)
+    {
+        rs2_vector data = frame.as<rs2::motion_frame>().get_motion_data();
+        std::lock_guard<std::mutex> guard(m_snapshotMutex);
+        if (stream == RS2_STREAM_GYRO)
+        {
+            m_snapshot.gyro = data;
+            m_snapshot.gyroTimestamp = timestamp;
+            m_snapshot.hasGyro = true;
+        }
+        else
+        {
+            m_snapshot.accel = data;
+            m_snapshot.accelTimestamp = timestamp;
+            m_snapshot.hasAccel = true;
+        }
+    }
+}
+
+bool realsense2Tracking::latestPose(rs2_pose& pose, double rpy[3], double& timestamp) const
+{
+    double arrival;
+    {
+        std::lock_guard<std::mutex> guard(m_snapshotMutex);
+        if (!m_snapshot.hasPose)
+        {
+            return false;
+        }
+        pose = m_snapshot.pose;
+        std::copy(m_snapshot.rpy, m_snapshot.rpy + 3, rpy);
+        timestamp = m_snapshot.poseTimestamp;
+        arrival = m_snapshot.poseArrival;
+    }
+    if (!m_posePrediction)
+    {
+        return true;
+    }
+
+    // The age of the sample is measured on the host clock, whatever the time base of the timestamps
+    double dt = std::min(std::max(yarp::os::Time::now() - arrival, 0.0), m_posePredictionHorizon);
+    pose = predictPose(pose, static_cast<float>(dt));
+    poseToRpy(pose, rpy);
+    timestamp += (m_timestamp_type == rs_timestamp) ? dt * 1000.0 : dt;
+    return true;
+}
+
+bool realsense2Tracking::getPredictedPose(double timestamp, yarp::sig::Vector& xyz, yarp::sig::Vector& rpy) const
+{
+    rs2_pose pose;
+    double sampleTimestamp;
+    {
+        std::lock_guard<std::mutex> guard(m_snapshotMutex);
+        if (!m_snapshot.hasPose)
+        {
+            return false;
+        }
+        pose = m_snapshot.pose;
+        sampleTimestamp = m_snapshot.poseTimestamp;
+    }
+    // The realsense timestamps are in milliseconds
+    double dt = timestamp - sampleTimestamp;
+    if (m_timestamp_type == rs_timestamp)
+    {
+        dt /= 1000.0;
+    }
+    dt = std::min(std::max(dt, -m_posePredictionHorizon), m_posePredictionHorizon);
+    pose = predictPose(pose, static_cast<float>(dt));
+
+    double angles[3];
+    poseToRpy(pose, angles);
+    xyz.resize(3);
+    xyz[0] = pose.translation.x;
+    xyz[1] = pose.translation.y;
+    xyz[2] = pose.translation.z;
+    rpy.resize(3);
+    rpy[0] = angles[0];
+    rpy[1] = angles[1];
+    rpy[2] = angles[2];
+    return true;
+}
+
 bool realsense2Tracking::pipelineRestart()
 {
     std::lock_guard<std::mutex> guard(m_mutex);
@@ -205,6 +358,29 @@ bool realsense2Tracking::open(Searchable& config)
         }
     }
 
+    if (config.check("serial"))
+    {
+        m_serial = config.find("serial").asString();
+    }
+    if (config.check("posePrediction"))
+    {
+        m_posePrediction = config.find("posePrediction").asBool();
+    }
+    if (config.check("posePredictionHorizon"))
+    {
+        m_posePredictionHorizon = config.find("posePredictionHorizon").asFloat64();
+    }
+    if (!realsense2Context::acquireDevice(m_serial, true, m_acquiredSerial))
+    {
+        if (m_serial.empty())
+            yCError(REALSENSE2TRACKING) << "No tracking device available, all the connected ones are already in use";
+        else
+            yCError(REALSENSE2TRACKING) << "The device with serial number" << m_serial << "is not connected or already in use";
+        return false;
+    }
+    yCInfo(REALSENSE2TRACKING) << "Using the device with serial number" << m_acquiredSerial;
+    m_cfg.enable_device(m_acquiredSerial);
+
     bool b= true;
 
     m_cfg.enable_stream(RS2_STREAM_ACCEL, RS2_FORMAT_MOTION_XYZ32F);
@@ -214,6 +390,8 @@ bool realsense2Tracking::open(Searchable& config)
     if (b==false)
     {
         yCError(REALSENSE2TRACKING) << "Pipeline initialization failed";
+        realsense2Context::releaseDevice(m_acquiredSerial);
+        m_acquiredSerial.clear();
         return false;
     }
 
@@ -223,6 +401,8 @@ bool realsense2Tracking::open(Searchable& config)
 bool realsense2Tracking::close()
 {
     pipelineShutdown();
+    realsense2Context::releaseDevice(m_acquiredSerial);
+    m_acquiredSerial.clear();
     return true;
 }
 
@@ -259,28 +439,16 @@ bool realsense2Tracking::getThreeAxisGyroscopeMeasure(size_t sens_index, yarp::s
         return false;
     }
 
-    std::lock_guard<std::mutex> guard(m_mutex);
-    rs2::frameset dataframe;
-    try
+    std::lock_guard<std::mutex> guard(m_snapshotMutex);
+    if (!m_snapshot.hasGyro)
     {
-        dataframe = m_pipeline.wait_for_frames();
-    }
-    catch (const rs2::error& e)
-    {
-        yCError(REALSENSE2TRACKING) << "m_pipeline.wait_for_frames() failed with error:"<< "(" << e.what() << ")";
-        m_lastError = e.what();
         return false;
     }
-    auto fg = dataframe.first_or_default(RS2_STREAM_GYRO, RS2_FORMAT_MOTION_XYZ32F);
-    rs2::motion_frame gyro = fg.as<rs2::motion_frame>();
-    if (m_timestamp_type == yarp_timestamp) { timestamp = yarp::os::Time::now(); }
-    else if (m_timestamp_type == rs_timestamp) { timestamp = gyro.get_timestamp(); }
-    else timestamp=0;
-    m_last_gyro = gyro.get_motion_data();
+    timestamp = m_snapshot.gyroTimestamp;
     out.resize(3);
-    out[0] = m_last_gyro.x;
-    out[1] = m_last_gyro.y;
-    out[2] = m_last_gyro.z;
+    out[0] = m_snapshot.gyro.x;
+    out[1] = m_snapshot.gyro.y;
+    out[2] = m_snapshot.gyro.z;
     return true;
 }
 
@@ -316,28 +484,16 @@ bool realsense2Tracking::getThreeAxisLinearAccelerometerMeasure(size_t sens_inde
 {
     if (sens_index != 0) { return false; }
 
-    std::lock_guard<std::mutex> guard(m_mutex);
-    rs2::frameset dataframe;
-    try
-    {
-        dataframe = m_pipeline.wait_for_frames();
-    }
-    catch (const rs2::error& e)
+    std::lock_guard<std::mutex> guard(m_snapshotMutex);
+    if (!m_snapshot.hasAccel)
     {
-        yCError(REALSENSE2TRACKING) << "m_pipeline.wait_for_frames() failed with error:"<< "(" << e.what() << ")";
-        m_lastError = e.what();
         return false;
     }
-    auto fa = dataframe.first_or_default(RS2_STREAM_ACCEL, RS2_FORMAT_MOTION_XYZ32F);
-    rs2::motion_frame accel = fa.as<rs2::motion_frame>();
-    m_last_accel = accel.get_motion_data();
-    if (m_timestamp_type == yarp_timestamp) { timestamp = yarp::os::Time::now(); }
-    else if (m_timestamp_type == rs_timestamp) { timestamp = accel.get_timestamp(); }
-    else timestamp = 0;
+    timestamp = m_snapshot.accelTimestamp;
     out.resize(3);
-    out[0] = m_last_accel.x;
-    out[1] = m_last_accel.y;
-    out[2] = m_last_accel.z;
+    out[0] = m_snapshot.accel.x;
+    out[1] = m_snapshot.accel.y;
+    out[2] = m_snapshot.accel.z;
     return true;
 }
 
@@ -374,31 +530,16 @@ bool realsense2Tracking::getOrientationSensorMeasureAsRollPitchYaw(size_t sens_i
 {
     if (sens_index != 0) { return false; }
 
-    std::lock_guard<std::mutex> guard(m_mutex);
-    rs2::frameset dataframe;
-    try
+    rs2_pose pose;
+    double angles[3];
+    if (!latestPose(pose, angles, timestamp))
     {
-        dataframe = m_pipeline.wait_for_frames();
-    }
-    catch (const rs2::error& e)
-    {
-        yCError(REALSENSE2TRACKING) << "m_pipeline.wait_for_frames() failed with error:"<< "(" << e.what() << ")";
-        m_lastError = e.what();
         return false;
     }
-    auto fa = dataframe.first_or_default(RS2_STREAM_POSE);
-    rs2::pose_frame pose = fa.as<rs2::pose_frame>();
-    m_last_pose = pose.get_pose_data();
-    if (m_timestamp_type == yarp_timestamp) { timestamp = yarp::os::Time::now(); }
-    else if (m_timestamp_type == rs_timestamp) { timestamp = pose.get_timestamp(); }
-    else timestamp = 0;
-    yarp::math::Quaternion q(m_last_pose.rotation.x, m_last_pose.rotation.y, m_last_pose.rotation.z, m_last_pose.rotation.w);
-    yarp::sig::Matrix mat = q.toRotationMatrix3x3();
-    yarp::sig::Vector rpy_temp = yarp::math::dcm2rpy(mat);
     rpy.resize(3);
-    rpy[0] = 0 + rpy_temp[0] * 180 / M_PI; //here we can eventually adjust the sign and/or sum an offset
-    rpy[1] = 0 + rpy_temp[1] * 180 / M_PI;
-    rpy[2] = 0 + rpy_temp[2] * 180 / M_PI;
+    rpy[0] = angles[0];
+    rpy[1] = angles[1];
+    rpy[2] = angles[2];
     return true;
 }
 
@@ -435,28 +576,16 @@ bool realsense2Tracking::getPositionSensorMeasure(size_t sens_index, yarp::sig::
 {
     if (sens_index != 0) { return false; }
 
-    std::lock_guard<std::mutex> guard(m_mutex);
-    rs2::frameset dataframe;
-    try
+    rs2_pose pose;
+    double angles[3];
+    if (!latestPose(pose, angles, timestamp))
     {
-        dataframe = m_pipeline.wait_for_frames();
-    }
-    catch (const rs2::error& e)
-    {
-        yCError(REALSENSE2TRACKING) << "m_pipeline.wait_for_frames() failed with error:"<< "(" << e.what() << ")";
-        m_lastError = e.what();
         return false;
     }
-    auto fa = dataframe.first_or_default(RS2_STREAM_POSE);
-    rs2::pose_frame pose = fa.as<rs2::pose_frame>();
-    m_last_pose = pose.get_pose_data();
-    if (m_timestamp_type == yarp_timestamp) { timestamp = yarp::os::Time::now(); }
-    else if (m_timestamp_type == rs_timestamp) { timestamp = pose.get_timestamp(); }
-    else timestamp = 0;
     xyz.resize(3);
-    xyz[0] = m_last_pose.translation.x;
-    xyz[1] = m_last_pose.translation.y;
-    xyz[2] = m_last_pose.translation.z;
+    xyz[0] = pose.translation.x;
+    xyz[1] = pose.translation.y;
+    xyz[2] = pose.translation.z;
     return true;
 }
 
@@ -464,21 +593,23 @@ int realsense2Tracking::read(yarp::sig::Vector& out)
 {
     // Publishes the data in the analog port as:
     // <positionX positionY positionZ QuaternionW QuaternionX QuaternionY QuaternionZ>
-    std::lock_guard<std::mutex> guard(m_mutex);
-    rs2::frameset dataframe = m_pipeline.wait_for_frames();
-    auto fa = dataframe.first_or_default(RS2_STREAM_POSE);
-    rs2::pose_frame pose = fa.as<rs2::pose_frame>();
-    m_last_pose = pose.get_pose_data();
+    rs2_pose pose;
+    double angles[3];
+    double timestamp;
+    if (!latestPose(pose, angles, timestamp))
+    {
+        return IAnalogSensor::AS_TIMEOUT;
+    }
 
     out.resize(7);
-    out[0] = m_last_pose.translation.x;
-    out[1] = m_last_pose.translation.y;
-    out[2] = m_last_pose.translation.z;
-    out[3] = m_last_pose.rotation.w;
-    out[4] = m_last_pose.rotation.x;
-    out[5] = m_last_pose.rotation.y;
-    out[6] = m_last_pose.rotation.z;
-    return 0;
+    out[0] = pose.translation.x;
+    out[1] = pose.translation.y;
+    out[2] = pose.translation.z;
+    out[3] = pose.rotation.w;
+    out[4] = pose.rotation.x;
+    out[5] = pose.rotation.y;
+    out[6] = pose.rotation.z;
+    return IAnalogSensor::AS_OK;
 }
 
 int realsense2Tracking::getState(int ch)
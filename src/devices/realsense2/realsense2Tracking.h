@@ -15,6 +15,7 @@
 #include <yarp/dev/MultipleAnalogSensorsInterfaces.h>
 #include <yarp/dev/IAnalogSensor.h>
 
+#include "realsense2Context.h"
 #include "realsense2Driver.h"
 #include <cstring>
 #include <iostream>
@@ -56,6 +57,11 @@ private:
     bool pipelineShutdown();
     bool pipelineRestart();
 
+    void onFrame(const rs2::frame& frame);
+    void storeFrame(const rs2::frame& frame);
+    // Latest pose, extrapolated to the query time when `posePrediction` is enabled
+    bool latestPose(rs2_pose& pose, double rpy[3], double& timestamp) const;
+
 public:
     /* IThreeAxisGyroscopes methods */
     size_t getNrOfThreeAxisGyroscopes() const override;
@@ -94,6 +100,14 @@ public:
     int calibrateChannel(int ch) override;
     int calibrateChannel(int ch, double value) override;
 
+    /**
+     * Pose extrapolated from the latest sample, with its velocities and accelerations, to the given time
+     * (same time base of the measure timestamps). The extrapolation is limited to `posePredictionHorizon`.
+     * Position in meters, roll pitch yaw in degrees.
+     * It is not part of a yarp interface, so it is only available to code that opens the device in the same process.
+     */
+    bool getPredictedPose(double timestamp, yarp::sig::Vector& xyz, yarp::sig::Vector& rpy) const;
+
 #if 0
     /* IPoseSensors methods */
     size_t getNrOfPoseSensors() const ;
@@ -104,10 +118,22 @@ public:
 #endif
 
 protected:
-    // realsense classes
-    mutable rs2_vector m_last_gyro;
-    mutable rs2_vector m_last_accel;
-    mutable rs2_pose   m_last_pose;
+    // Latest samples of all the streams, written by the pipeline callback and copied by the getters
+    struct trackingSnapshot
+    {
+        rs2_vector gyro{0, 0, 0};
+        rs2_vector accel{0, 0, 0};
+        rs2_pose   pose{};
+        double     rpy[3]{0.0, 0.0, 0.0}; // of pose, in degrees, converted once per sample
+        double     poseArrival{0.0};      // yarp time of reception of the pose
+        double     gyroTimestamp{0.0};
+        double     accelTimestamp{0.0};
+        double     poseTimestamp{0.0};
+        bool       hasGyro{false};
+        bool       hasAccel{false};
+        bool       hasPose{false};
+    };
+    trackingSnapshot m_snapshot;
 
     //strings
     std::string       m_inertial_sensor_name_prefix;
@@ -124,11 +150,16 @@ protected:
 
     rs2::config   m_cfg;
     mutable std::mutex    m_mutex;
+    mutable std::mutex    m_snapshotMutex;
     rs2::pipeline m_pipeline;
     rs2::pipeline_profile m_profile;
+    std::string   m_serial;
+    std::string   m_acquiredSerial;
     mutable std::string m_lastError;
     enum timestamp_enumtype {yarp_timestamp=0, rs_timestamp};
     timestamp_enumtype m_timestamp_type;
+    bool               m_posePrediction{false};
+    double             m_posePredictionHorizon{0.05};
 
     /*
     rs2::context m_ctx;
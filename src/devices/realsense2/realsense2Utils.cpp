@@ -0,0 +1,737 @@
+/*
+ * Copyright (C) 2006-2020 Istituto Italiano di Tecnologia (IIT)
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms of the
+ * BSD-3-Clause license. See the accompanying LICENSE file for details.
+ */
+
+#include "realsense2Utils.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__AVX2__)
+#  include <immintrin.h>
+#  define REALSENSE2_USE_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  include <emmintrin.h>
+#  define REALSENSE2_USE_SSE2
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#  include <arm_neon.h>
+#  define REALSENSE2_USE_NEON
+#endif
+
+#if defined(REALSENSE2_USE_AVX2) || defined(REALSENSE2_USE_SSE2)
+#  define REALSENSE2_USE_X86
+// MSVC defines __AVX2__ with /arch:AVX2, but never __SSSE3__
+#  if defined(__SSSE3__) || defined(REALSENSE2_USE_AVX2)
+#    include <tmmintrin.h>
+#    define REALSENSE2_USE_SSSE3
+#  endif
+#endif
+
+namespace realsense2Utils {
+
+namespace {
+
+template <bool Quantize>
+inline float convertDepthSample(uint16_t raw, float scale, float quantCoeff)
+{
+    float value = scale * raw;
+    if (Quantize)
+    {
+        value = ((float) ((int) (value * quantCoeff))) / quantCoeff;
+    }
+    return value;
+}
+
+template <bool Reverse, bool Quantize>
+void convertDepth(const uint16_t* src, float* dst, size_t count, float scale, float quantCoeff)
+{
+    size_t i = 0;
+
+#if defined(REALSENSE2_USE_AVX2)
+    const __m256  vScale = _mm256_set1_ps(scale);
+    const __m256  vQuant = _mm256_set1_ps(quantCoeff);
+    const __m256i vReverse = _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+    for (; i + 16 <= count; i += 16)
+    {
+        const uint16_t* s = Reverse ? src + count - 16 - i : src + i;
+        __m256i raw = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s));
+        __m256 lo = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm256_castsi256_si128(raw)));
+        __m256 hi = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm256_extracti128_si256(raw, 1)));
+        lo = _mm256_mul_ps(lo, vScale);
+        hi = _mm256_mul_ps(hi, vScale);
+        if (Quantize)
+        {
+            lo = _mm256_div_ps(_mm256_cvtepi32_ps(_mm256_cvttps_epi32(_mm256_mul_ps(lo, vQuant))), vQuant);
+            hi = _mm256_div_ps(_mm256_cvtepi32_ps(_mm256_cvttps_epi32(_mm256_mul_ps(hi, vQuant))), vQuant);
+        }
+        if (Reverse)
+        {
+            _mm256_storeu_ps(dst + i,     _mm256_permutevar8x32_ps(hi, vReverse));
+            _mm256_storeu_ps(dst + i + 8, _mm256_permutevar8x32_ps(lo, vReverse));
+        }
+        else
+        {
+            _mm256_storeu_ps(dst + i,     lo);
+            _mm256_storeu_ps(dst + i + 8, hi);
+        }
+    }
+#elif defined(REALSENSE2_USE_SSE2)
+    const __m128  vScale = _mm_set1_ps(scale);
+    const __m128  vQuant = _mm_set1_ps(quantCoeff);
+    const __m128i zero   = _mm_setzero_si128();
+    for (; i + 8 <= count; i += 8)
+    {
+        const uint16_t* s = Reverse ? src + count - 8 - i : src + i;
+        __m128i raw = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s));
+        __m128 lo = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(raw, zero)), vScale);
+        __m128 hi = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(raw, zero)), vScale);
+        if (Quantize)
+        {
+            lo = _mm_div_ps(_mm_cvtepi32_ps(_mm_cvttps_epi32(_mm_mul_ps(lo, vQuant))), vQuant);
+            hi = _mm_div_ps(_mm_cvtepi32_ps(_mm_cvttps_epi32(_mm_mul_ps(hi, vQuant))), vQuant);
+        }
+        if (Reverse)
+        {
+            _mm_storeu_ps(dst + i,     _mm_shuffle_ps(hi, hi, _MM_SHUFFLE(0, 1, 2, 3)));
+            _mm_storeu_ps(dst + i + 4, _mm_shuffle_ps(lo, lo, _MM_SHUFFLE(0, 1, 2, 3)));
+        }
+        else
+        {
+            _mm_storeu_ps(dst + i,     lo);
+            _mm_storeu_ps(dst + i + 4, hi);
+        }
+    }
+#elif defined(REALSENSE2_USE_NEON)
+    const float32x4_t vScale = vdupq_n_f32(scale);
+    const float32x4_t vQuant = vdupq_n_f32(quantCoeff);
+    for (; i + 8 <= count; i += 8)
+    {
+        const uint16_t* s = Reverse ? src + count - 8 - i : src + i;
+        uint16x8_t raw = vld1q_u16(s);
+        float32x4_t lo = vmulq_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(raw))), vScale);
+        float32x4_t hi = vmulq_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(raw))), vScale);
+        if (Quantize)
+        {
+            lo = vdivq_f32(vcvtq_f32_s32(vcvtq_s32_f32(vmulq_f32(lo, vQuant))), vQuant);
+            hi = vdivq_f32(vcvtq_f32_s32(vcvtq_s32_f32(vmulq_f32(hi, vQuant))), vQuant);
+        }
+        if (Reverse)
+        {
+            float32x4_t rhi = vrev64q_f32(hi);
+            float32x4_t rlo = vrev64q_f32(lo);
+            vst1q_f32(dst + i,     vcombine_f32(vget_high_f32(rhi), vget_low_f32(rhi)));
+            vst1q_f32(dst + i + 4, vcombine_f32(vget_high_f32(rlo), vget_low_f32(rlo)));
+        }
+        else
+        {
+            vst1q_f32(dst + i,     lo);
+            vst1q_f32(dst + i + 4, hi);
+        }
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        dst[i] = convertDepthSample<Quantize>(Reverse ? src[count - 1 - i] : src[i], scale, quantCoeff);
+    }
+}
+
+#if defined(REALSENSE2_USE_SSSE3)
+// pshufb masks reversing 16 packed 24 bit pixels (3 registers): the output register r
+// is the OR of the source registers q shuffled by rgbReverseMasks[r][q].
+struct rgbReverseMaskTable
+{
+    alignas(16) unsigned char mask[3][3][16];
+
+    rgbReverseMaskTable()
+    {
+        for (int o = 0; o < 48; o++)
+        {
+            int in = (15 - o / 3) * 3 + o % 3;
+            for (int q = 0; q < 3; q++)
+            {
+                mask[o / 16][q][o % 16] = (in / 16 == q) ? static_cast<unsigned char>(in % 16) : 0x80;
+            }
+        }
+    }
+};
+const rgbReverseMaskTable rgbReverseMasks;
+#endif
+
+// Writes the pixels of src in reverse order, i.e. rotates a packed image by 180 degrees
+template <size_t Bpp>
+void reversePixels(const unsigned char* src, unsigned char* dst, size_t count)
+{
+    size_t i = 0;
+#if defined(REALSENSE2_USE_X86)
+    if (Bpp == 1 || Bpp == 2 || Bpp == 4)
+    {
+        const size_t perBlock = 16 / Bpp;
+        for (; i + perBlock <= count; i += perBlock)
+        {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + (count - perBlock - i) * Bpp));
+            v = _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3));
+            if (Bpp < 4)
+            {
+                v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1)), _MM_SHUFFLE(2, 3, 0, 1));
+            }
+            if (Bpp < 2)
+            {
+                v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * Bpp), v);
+        }
+    }
+#  if defined(REALSENSE2_USE_SSSE3)
+    if (Bpp == 3)
+    {
+        const auto& m = rgbReverseMasks.mask;
+        for (; i + 16 <= count; i += 16)
+        {
+            const unsigned char* s = src + (count - 16 - i) * 3;
+            __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s));
+            __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + 16));
+            __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + 32));
+            for (int r = 0; r < 3; r++)
+            {
+                __m128i v = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, _mm_load_si128(reinterpret_cast<const __m128i*>(m[r][0]))),
+                                                      _mm_shuffle_epi8(b, _mm_load_si128(reinterpret_cast<const __m128i*>(m[r][1])))),
+                                         _mm_shuffle_epi8(c, _mm_load_si128(reinterpret_cast<const __m128i*>(m[r][2]))));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 3 + r * 16), v);
+            }
+        }
+    }
+#  endif
+#elif defined(REALSENSE2_USE_NEON)
+    if (Bpp == 1)
+    {
+        for (; i + 16 <= count; i += 16)
+        {
+            uint8x16_t v = vrev64q_u8(vld1q_u8(src + count - 16 - i));
+            vst1q_u8(dst + i, vcombine_u8(vget_high_u8(v), vget_low_u8(v)));
+        }
+    }
+    else if (Bpp == 2)
+    {
+        for (; i + 8 <= count; i += 8)
+        {
+            uint16x8_t v = vrev64q_u16(vld1q_u16(reinterpret_cast<const uint16_t*>(src + (count - 8 - i) * 2)));
+            vst1q_u16(reinterpret_cast<uint16_t*>(dst + i * 2), vcombine_u16(vget_high_u16(v), vget_low_u16(v)));
+        }
+    }
+    else if (Bpp == 3)
+    {
+        for (; i + 16 <= count; i += 16)
+        {
+            uint8x16x3_t v = vld3q_u8(src + (count - 16 - i) * 3);
+            for (int c = 0; c < 3; c++)
+            {
+                uint8x16_t r = vrev64q_u8(v.val[c]);
+                v.val[c] = vcombine_u8(vget_high_u8(r), vget_low_u8(r));
+            }
+            vst3q_u8(dst + i * 3, v);
+        }
+    }
+    else if (Bpp == 4)
+    {
+        for (; i + 4 <= count; i += 4)
+        {
+            uint32x4_t v = vrev64q_u32(vld1q_u32(reinterpret_cast<const uint32_t*>(src + (count - 4 - i) * 4)));
+            vst1q_u32(reinterpret_cast<uint32_t*>(dst + i * 4), vcombine_u32(vget_high_u32(v), vget_low_u32(v)));
+        }
+    }
+#endif
+    for (; i < count; i++)
+    {
+        memcpy(dst + i * Bpp, src + (count - 1 - i) * Bpp, Bpp);
+    }
+}
+
+// Rotates by 90 degrees processing square tiles, so that both the rows read
+// and the columns written stay in cache.
+template <size_t Bpp, bool Clockwise>
+void rotateQuarter(const unsigned char* src, unsigned char* dst, size_t width, size_t height)
+{
+    constexpr size_t tile = 64 / Bpp;
+    for (size_t y0 = 0; y0 < height; y0 += tile)
+    {
+        const size_t y1 = std::min(y0 + tile, height);
+        for (size_t x0 = 0; x0 < width; x0 += tile)
+        {
+            const size_t x1 = std::min(x0 + tile, width);
+            for (size_t y = y0; y < y1; y++)
+            {
+                const unsigned char* srcRow = src + y * width * Bpp;
+                const size_t dx = Clockwise ? height - 1 - y : y;
+                for (size_t x = x0; x < x1; x++)
+                {
+                    const size_t dy = Clockwise ? x : width - 1 - x;
+                    memcpy(dst + (dy * height + dx) * Bpp, srcRow + x * Bpp, Bpp);
+                }
+            }
+        }
+    }
+}
+
+template <size_t Bpp>
+bool rotateImage(const unsigned char* src, unsigned char* dst, size_t width, size_t height, int angle)
+{
+    switch (angle)
+    {
+    case 0:
+        memcpy(dst, src, width * height * Bpp);
+        return true;
+    case 90:
+        rotateQuarter<Bpp, true>(src, dst, width, height);
+        return true;
+    case 180:
+        reversePixels<Bpp>(src, dst, width * height);
+        return true;
+    case 270:
+        rotateQuarter<Bpp, false>(src, dst, width, height);
+        return true;
+    default:
+        return false;
+    }
+}
+
+} // namespace
+
+depthConversionFn selectDepthConversion(bool rotate180, bool quantize)
+{
+    if (rotate180)
+    {
+        return quantize ? &convertDepth<true, true> : &convertDepth<true, false>;
+    }
+    return quantize ? &convertDepth<false, true> : &convertDepth<false, false>;
+}
+
+void quantizeDepth(const uint16_t* src, uint16_t* dst, size_t count, float scale, float quantCoeff)
+{
+    // Same products and truncation of convertDepth<*, true>(), so that step / quantCoeff is its exact result
+    size_t i = 0;
+
+#if defined(REALSENSE2_USE_AVX2)
+    const __m256 vScale = _mm256_set1_ps(scale);
+    const __m256 vQuant = _mm256_set1_ps(quantCoeff);
+    for (; i + 16 <= count; i += 16)
+    {
+        __m256i raw = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        __m256 lo = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm256_castsi256_si128(raw)));
+        __m256 hi = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm256_extracti128_si256(raw, 1)));
+        __m256i qlo = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_mul_ps(lo, vScale), vQuant));
+        __m256i qhi = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_mul_ps(hi, vScale), vQuant));
+        // packus works within the 128 bit lanes, the 64 bit blocks are put back in order
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(qlo, qhi), _MM_SHUFFLE(3, 1, 2, 0));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), packed);
+    }
+#elif defined(REALSENSE2_USE_SSE2)
+    const __m128  vScale = _mm_set1_ps(scale);
+    const __m128  vQuant = _mm_set1_ps(quantCoeff);
+    const __m128i zero   = _mm_setzero_si128();
+    const __m128i bias32 = _mm_set1_epi32(32768);
+    const __m128i bias16 = _mm_set1_epi16(static_cast<short>(0x8000));
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i raw = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128 lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(raw, zero));
+        __m128 hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(raw, zero));
+        __m128i qlo = _mm_cvttps_epi32(_mm_mul_ps(_mm_mul_ps(lo, vScale), vQuant));
+        __m128i qhi = _mm_cvttps_epi32(_mm_mul_ps(_mm_mul_ps(hi, vScale), vQuant));
+        // SSE2 has only the signed saturating pack: shift to the signed range and back
+        __m128i packed = _mm_packs_epi32(_mm_sub_epi32(qlo, bias32), _mm_sub_epi32(qhi, bias32));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_xor_si128(packed, bias16));
+    }
+#elif defined(REALSENSE2_USE_NEON)
+    const float32x4_t vScale = vdupq_n_f32(scale);
+    const float32x4_t vQuant = vdupq_n_f32(quantCoeff);
+    for (; i + 8 <= count; i += 8)
+    {
+        uint16x8_t raw = vld1q_u16(src + i);
+        float32x4_t lo = vcvtq_f32_u32(vmovl_u16(vget_low_u16(raw)));
+        float32x4_t hi = vcvtq_f32_u32(vmovl_u16(vget_high_u16(raw)));
+        uint32x4_t qlo = vcvtq_u32_f32(vmulq_f32(vmulq_f32(lo, vScale), vQuant));
+        uint32x4_t qhi = vcvtq_u32_f32(vmulq_f32(vmulq_f32(hi, vScale), vQuant));
+        vst1q_u16(dst + i, vcombine_u16(vqmovn_u32(qlo), vqmovn_u32(qhi)));
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        int step = static_cast<int>(scale * src[i] * quantCoeff);
+        dst[i] = static_cast<uint16_t>(std::min(step, 65535));
+    }
+}
+
+bool rotateImage(const unsigned char* src, unsigned char* dst, size_t width, size_t height, size_t bytesPerPixel, int angle)
+{
+    switch (bytesPerPixel)
+    {
+    case 1:
+        return rotateImage<1>(src, dst, width, height, angle);
+    case 2:
+        return rotateImage<2>(src, dst, width, height, angle);
+    case 3:
+        return rotateImage<3>(src, dst, width, height, angle);
+    case 4:
+        return rotateImage<4>(src, dst, width, height, angle);
+    default:
+        return false;
+    }
+}
+
+namespace {
+
+inline unsigned char clampChannel(int value)
+{
+    return static_cast<unsigned char>(value < 0 ? 0 : (value > 255 ? 255 : value));
+}
+
+template <bool Bgr>
+void convertYuyvPixels(const unsigned char* src, unsigned char* dst, size_t count)
+{
+    size_t i = 0;
+
+#if defined(REALSENSE2_USE_X86)
+    // 8 pixels per iteration: the products are computed in 32 bits with madd on (y, u) and (y, v) pairs
+    const __m128i zero    = _mm_setzero_si128();
+    const __m128i offset  = _mm_setr_epi16(16, 128, 16, 128, 16, 128, 16, 128);
+    const __m128i evenPix = _mm_setr_epi32(-1, 0, -1, 0);
+    const __m128i kR      = _mm_setr_epi16(298, 409, 298, 409, 298, 409, 298, 409);
+    const __m128i kB      = _mm_setr_epi16(298, 516, 298, 516, 298, 516, 298, 516);
+    const __m128i kGu     = _mm_setr_epi16(298, -100, 298, -100, 298, -100, 298, -100);
+    const __m128i kGv     = _mm_setr_epi16(0, -208, 0, -208, 0, -208, 0, -208);
+    const __m128i round   = _mm_set1_epi32(128);
+    alignas(16) unsigned char r[16];
+    alignas(16) unsigned char g[16];
+    alignas(16) unsigned char b[16];
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i raw = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 2));
+        __m128i channels[3][2];
+        for (int half = 0; half < 2; half++)
+        {
+            // (y0, u, y1, v) of two pixels per 64 bits: even pixels pair with u, odd pixels with v
+            __m128i a = _mm_sub_epi16(half == 0 ? _mm_unpacklo_epi8(raw, zero) : _mm_unpackhi_epi8(raw, zero), offset);
+            __m128i swapped = _mm_shufflehi_epi16(_mm_shufflelo_epi16(a, _MM_SHUFFLE(1, 2, 3, 0)), _MM_SHUFFLE(1, 2, 3, 0));
+            __m128i yu = _mm_or_si128(_mm_and_si128(evenPix, a), _mm_andnot_si128(evenPix, swapped));
+            __m128i yv = _mm_or_si128(_mm_and_si128(evenPix, swapped), _mm_andnot_si128(evenPix, a));
+            channels[0][half] = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(yv, kR), round), 8);
+            channels[1][half] = _mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(_mm_madd_epi16(yu, kGu), _mm_madd_epi16(yv, kGv)), round), 8);
+            channels[2][half] = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(yu, kB), round), 8);
+        }
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(r), _mm_packus_epi16(_mm_packs_epi32(channels[0][0], channels[0][1]), zero));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(g), _mm_packus_epi16(_mm_packs_epi32(channels[1][0], channels[1][1]), zero));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(b), _mm_packus_epi16(_mm_packs_epi32(channels[2][0], channels[2][1]), zero));
+        unsigned char* out = dst + i * 3;
+        for (int p = 0; p < 8; p++)
+        {
+            out[p * 3]     = Bgr ? b[p] : r[p];
+            out[p * 3 + 1] = g[p];
+            out[p * 3 + 2] = Bgr ? r[p] : b[p];
+        }
+    }
+#endif
+
+    for (; i + 2 <= count; i += 2)
+    {
+        const unsigned char* in = src + i * 2;
+        const int u = in[1] - 128;
+        const int v = in[3] - 128;
+        for (int p = 0; p < 2; p++)
+        {
+            const int y = in[p * 2] - 16;
+            const unsigned char red   = clampChannel((298 * y + 409 * v + 128) >> 8);
+            const unsigned char green = clampChannel((298 * y - 100 * u - 208 * v + 128) >> 8);
+            const unsigned char blue  = clampChannel((298 * y + 516 * u + 128) >> 8);
+            unsigned char* out = dst + (i + p) * 3;
+            out[0] = Bgr ? blue : red;
+            out[1] = green;
+            out[2] = Bgr ? red : blue;
+        }
+    }
+}
+
+} // namespace
+
+void convertYuyv(const unsigned char* src, unsigned char* dst, size_t count, bool bgr)
+{
+    if (bgr)
+    {
+        convertYuyvPixels<true>(src, dst, count);
+    }
+    else
+    {
+        convertYuyvPixels<false>(src, dst, count);
+    }
+}
+
+void deprojectDepth(const uint16_t* depth, const float* rayX, const float* rayY, size_t count, float scale,
+                    float* dst, size_t stride)
+{
+    size_t i = 0;
+
+#if defined(REALSENSE2_USE_X86)
+    const __m128  vScale = _mm_set1_ps(scale);
+    const __m128i zero   = _mm_setzero_si128();
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i raw = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(depth + i));
+        __m128 z = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(raw, zero)), vScale);
+        __m128 x = _mm_mul_ps(_mm_loadu_ps(rayX + i), z);
+        __m128 y = _mm_mul_ps(_mm_loadu_ps(rayY + i), z);
+        __m128 w = _mm_setzero_ps();
+        // One (x, y, z, 0) register per point, only x, y and z are stored
+        _MM_TRANSPOSE4_PS(x, y, z, w);
+        const __m128 points[4] = { x, y, z, w };
+        for (size_t p = 0; p < 4; p++)
+        {
+            float* out = dst + (i + p) * stride;
+            _mm_storel_pi(reinterpret_cast<__m64*>(out), points[p]);
+            _mm_store_ss(out + 2, _mm_movehl_ps(points[p], points[p]));
+        }
+    }
+#elif defined(REALSENSE2_USE_NEON)
+    const float32x4_t vScale = vdupq_n_f32(scale);
+    for (; i + 4 <= count; i += 4)
+    {
+        float32x4_t z = vmulq_f32(vcvtq_f32_u32(vmovl_u16(vld1_u16(depth + i))), vScale);
+        float32x4_t x = vmulq_f32(vld1q_f32(rayX + i), z);
+        float32x4_t y = vmulq_f32(vld1q_f32(rayY + i), z);
+        float32x4x3_t points = { { x, y, z } };
+        if (stride == 3)
+        {
+            vst3q_f32(dst + i * 3, points);
+        }
+        else
+        {
+            float packed[12];
+            vst3q_f32(packed, points);
+            for (size_t p = 0; p < 4; p++)
+            {
+                memcpy(dst + (i + p) * stride, packed + p * 3, 3 * sizeof(float));
+            }
+        }
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        const float z = scale * depth[i];
+        float* out = dst + i * stride;
+        out[0] = rayX[i] * z;
+        out[1] = rayY[i] * z;
+        out[2] = z;
+    }
+}
+
+namespace {
+
+template <typename T>
+unsigned int lowestSetBit(T mask)
+{
+#if defined(__GNUC__)
+    return sizeof(T) > sizeof(unsigned int) ? __builtin_ctzll(mask) : __builtin_ctz(static_cast<unsigned int>(mask));
+#else
+    unsigned int bit = 0;
+    while (!(mask & 1))
+    {
+        mask >>= 1;
+        bit++;
+    }
+    return bit;
+#endif
+}
+
+// Length of the run of zero (or of valid) samples at the start of [p, p + n)
+template <bool zeros>
+size_t runLength(const uint16_t* p, size_t n)
+{
+    size_t i = 0;
+
+#if defined(REALSENSE2_USE_X86)
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 8 <= n; i += 8)
+    {
+        // Two mask bits per sample, set for the zero samples
+        unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i)), zero)));
+        unsigned int end = zeros ? (~mask & 0xFFFFu) : mask;
+        if (end != 0)
+        {
+            return i + lowestSetBit(end) / 2;
+        }
+    }
+#elif defined(REALSENSE2_USE_NEON)
+    for (; i + 8 <= n; i += 8)
+    {
+        // Eight mask bits per sample, set for the zero samples
+        uint16x8_t isZero = vceqq_u16(vld1q_u16(p + i), vdupq_n_u16(0));
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vmovn_u16(isZero)), 0);
+        uint64_t end = zeros ? ~mask : mask;
+        if (end != 0)
+        {
+            return i + lowestSetBit(end) / 8;
+        }
+    }
+#endif
+
+    for (; i < n && (p[i] == 0) == zeros; i++) {}
+    return i;
+}
+
+class rvlWriter
+{
+public:
+    explicit rvlWriter(std::vector<unsigned char>& dst) : m_dst(dst) {}
+
+    void put(uint32_t value)
+    {
+        // 3 bits per nibble, the high bit flags a following nibble
+        do
+        {
+            uint32_t nibble = value & 7;
+            value >>= 3;
+            if (value)
+            {
+                nibble |= 8;
+            }
+            m_word = (m_word << 4) | nibble;
+            if (++m_nibbles == 8)
+            {
+                flush();
+            }
+        } while (value);
+    }
+
+    void finish()
+    {
+        if (m_nibbles)
+        {
+            m_word <<= 4 * (8 - m_nibbles);
+            flush();
+        }
+    }
+
+private:
+    void flush()
+    {
+        unsigned char bytes[4] = { static_cast<unsigned char>(m_word), static_cast<unsigned char>(m_word >> 8),
+                                   static_cast<unsigned char>(m_word >> 16), static_cast<unsigned char>(m_word >> 24) };
+        m_dst.insert(m_dst.end(), bytes, bytes + 4);
+        m_word = 0;
+        m_nibbles = 0;
+    }
+
+    std::vector<unsigned char>& m_dst;
+    uint32_t                    m_word{0};
+    int                         m_nibbles{0};
+};
+
+class rvlReader
+{
+public:
+    rvlReader(const unsigned char* src, size_t size) : m_src(src), m_size(size) {}
+
+    bool get(uint32_t& value)
+    {
+        value = 0;
+        for (unsigned int shift = 0; shift < 32; shift += 3)
+        {
+            if (m_nibbles == 0)
+            {
+                if (m_pos + 4 > m_size)
+                {
+                    return false;
+                }
+                m_word = static_cast<uint32_t>(m_src[m_pos]) | static_cast<uint32_t>(m_src[m_pos + 1]) << 8 |
+                         static_cast<uint32_t>(m_src[m_pos + 2]) << 16 | static_cast<uint32_t>(m_src[m_pos + 3]) << 24;
+                m_pos += 4;
+                m_nibbles = 8;
+            }
+            uint32_t nibble = m_word >> 28;
+            m_word <<= 4;
+            m_nibbles--;
+            value |= (nibble & 7) << shift;
+            if (!(nibble & 8))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    const unsigned char* m_src;
+    size_t               m_size;
+    size_t               m_pos{0};
+    uint32_t             m_word{0};
+    int                  m_nibbles{0};
+};
+
+} // namespace
+
+size_t encodeRvl(const uint16_t* src, size_t count, std::vector<unsigned char>& dst)
+{
+    const size_t start = dst.size();
+    // Typical depth images compress 3-5x, reserve for the common case
+    dst.reserve(start + count / 2);
+    rvlWriter writer(dst);
+    int previous = 0;
+    size_t i = 0;
+    while (i < count)
+    {
+        size_t zeros = runLength<true>(src + i, count - i);
+        writer.put(static_cast<uint32_t>(zeros));
+        i += zeros;
+        size_t valid = runLength<false>(src + i, count - i);
+        writer.put(static_cast<uint32_t>(valid));
+        for (size_t end = i + valid; i < end; i++)
+        {
+            int delta = static_cast<int>(src[i]) - previous;
+            writer.put((static_cast<uint32_t>(delta) << 1) ^ static_cast<uint32_t>(delta >> 31));
+            previous = src[i];
+        }
+    }
+    writer.finish();
+    return dst.size() - start;
+}
+
+bool decodeRvl(const unsigned char* src, size_t size, uint16_t* dst, size_t count)
+{
+    rvlReader reader(src, size);
+    int previous = 0;
+    size_t i = 0;
+    while (i < count)
+    {
+        uint32_t zeros = 0;
+        uint32_t valid = 0;
+        if (!reader.get(zeros) || zeros > count - i)
+        {
+            return false;
+        }
+        std::fill(dst + i, dst + i + zeros, uint16_t{0});
+        i += zeros;
+        if (!reader.get(valid) || valid > count - i)
+        {
+            return false;
+        }
+        for (size_t end = i + valid; i < end; i++)
+        {
+            uint32_t zigzag = 0;
+            if (!reader.get(zigzag))
+            {
+                return false;
+            }
+            int delta = static_cast<int>(zigzag >> 1) ^ -static_cast<int>(zigzag & 1);
+            previous += delta;
+            dst[i] = static_cast<uint16_t>(previous);
+        }
+    }
+    return true;
+}
+
+} // namespace realsense2Utils
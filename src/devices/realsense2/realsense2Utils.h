@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2006-2020 Istituto Italiano di Tecnologia (IIT)
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms of the
+ * BSD-3-Clause license. See the accompanying LICENSE file for details.
+ */
+
+#ifndef REALSENSE2_UTILS_H
+#define REALSENSE2_UTILS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Pixel conversion kernels used by the realsense2 devices.
+ * Each kernel has a SIMD implementation (AVX2 or SSE2 on x86, NEON on AArch64)
+ * and a scalar fallback, selected at compile time.
+ */
+namespace realsense2Utils {
+
+/**
+ * Converts `count` Z16 samples to meters: dst[i] = scale * src[i].
+ * When quantization is enabled the result is truncated to the decimal places
+ * encoded by quantCoeff (10^decimals), i.e. dst[i] = int(dst[i] * quantCoeff) / quantCoeff.
+ * The reversed variants write the samples in reverse order (180 degrees rotation).
+ */
+typedef void (*depthConversionFn)(const uint16_t* src, float* dst, size_t count, float scale, float quantCoeff);
+
+/**
+ * Returns the depth conversion kernel matching the configuration, so that the
+ * rotation and quantization flags are not checked for every pixel.
+ */
+depthConversionFn selectDepthConversion(bool rotate180, bool quantize);
+
+/**
+ * Writes the quantization step of `count` Z16 samples, dst[i] = int(scale * src[i] * quantCoeff),
+ * saturated to 65535. The products and the truncation are the ones of the quantized depth conversion,
+ * so dst[i] / quantCoeff is exactly the quantized depth in meters.
+ */
+void quantizeDepth(const uint16_t* src, uint16_t* dst, size_t count, float scale, float quantCoeff);
+
+/**
+ * Rotates a tightly packed image clockwise by `angle` degrees (0, 90, 180 or 270).
+ * `width` and `height` are the size of the source image, the destination is
+ * height x width when rotating by 90 or 270 degrees.
+ * Pixels of 1, 2, 3 and 4 bytes are supported.
+ * @return false if the angle or the pixel size are not supported.
+ */
+bool rotateImage(const unsigned char* src, unsigned char* dst, size_t width, size_t height, size_t bytesPerPixel, int angle);
+
+/**
+ * Converts `count` YUYV (YUY2) pixels, `count` even, to packed RGB or BGR with the BT.601 integer
+ * coefficients used by librealsense, so that the result matches the RGB8 stream.
+ * SSE2 implementation on x86, scalar elsewhere.
+ */
+void convertYuyv(const unsigned char* src, unsigned char* dst, size_t count, bool bgr);
+
+/**
+ * Converts `count` Z16 samples to 3D points using precomputed per-pixel rays (the deprojection of the
+ * pixel at unit depth): z = scale * depth[i], x = rayX[i] * z, y = rayY[i] * z.
+ * Each point is written as three floats at dst + i * stride, with the stride in floats (at least 3).
+ * Invalid (zero) samples give the origin.
+ */
+void deprojectDepth(const uint16_t* depth, const float* rayX, const float* rayY, size_t count, float scale,
+                    float* dst, size_t stride);
+
+/**
+ * Lossless RVL compression of `count` Z16 samples (A. D. Wilson, "Fast Lossless Depth Image Compression", 2017):
+ * alternating runs of zero and valid samples, the valid ones as zigzag deltas from the previous valid sample,
+ * coded as variable length nibbles packed in little endian 32 bit words. The encoded bytes are appended to `dst`.
+ * The run lengths are found with SIMD comparisons (SSE2 on x86, NEON on AArch64), the coding is sequential.
+ * @return the number of bytes appended
+ */
+size_t encodeRvl(const uint16_t* src, size_t count, std::vector<unsigned char>& dst);
+
+/**
+ * Decodes `count` Z16 samples encoded by encodeRvl().
+ * @return false if the data is truncated or does not describe exactly `count` samples
+ */
+bool decodeRvl(const unsigned char* src, size_t size, uint16_t* dst, size_t count);
+
+} // namespace realsense2Utils
+
+#endif
@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2006-2020 Istituto Italiano di Tecnologia (IIT)
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms of the
+ * BSD-3-Clause license. See the accompanying LICENSE file for details.
+ */
+
+#include "realsense2WorkerPool.h"
+
+#include <algorithm>
+
+realsense2WorkerPool::realsense2WorkerPool(size_t threads)
+{
+    for (size_t i = 1; i < threads; i++)
+    {
+        m_threads.emplace_back(&realsense2WorkerPool::workerLoop, this);
+    }
+}
+
+realsense2WorkerPool::~realsense2WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_stopping = true;
+    }
+    m_changed.notify_all();
+    for (auto& thread : m_threads)
+    {
+        thread.join();
+    }
+}
+
+size_t realsense2WorkerPool::size() const
+{
+    return m_threads.size() + 1;
+}
+
+void realsense2WorkerPool::execute(std::unique_lock<std::mutex>& lock)
+{
+    job next = m_jobs.front();
+    m_jobs.pop_front();
+    lock.unlock();
+    (*next.task)();
+    lock.lock();
+    if (--next.owner->pending == 0)
+    {
+        m_changed.notify_all();
+    }
+}
+
+void realsense2WorkerPool::workerLoop()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true)
+    {
+        m_changed.wait(lock, [this] { return m_stopping || !m_jobs.empty(); });
+        if (m_stopping)
+        {
+            return;
+        }
+        execute(lock);
+    }
+}
+
+void realsense2WorkerPool::run(std::vector<std::function<void()>>& tasks)
+{
+    if (tasks.empty())
+    {
+        return;
+    }
+
+    batch current;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    current.pending = tasks.size() - 1;
+    for (size_t i = 1; i < tasks.size(); i++)
+    {
+        m_jobs.push_back(job{&tasks[i], &current});
+    }
+    if (current.pending > 0)
+    {
+        m_changed.notify_all();
+    }
+
+    // The first task runs here, then the caller helps with the queue until its batch is completed
+    lock.unlock();
+    tasks[0]();
+    lock.lock();
+    while (current.pending > 0)
+    {
+        if (!m_jobs.empty())
+        {
+            execute(lock);
+        }
+        else
+        {
+            m_changed.wait(lock);
+        }
+    }
+}
+
+void realsense2WorkerPool::parallelFor(size_t count, const std::function<void(size_t, size_t)>& task)
+{
+    const size_t stripes = std::min(size(), count);
+    std::vector<std::function<void()>> tasks;
+    tasks.reserve(stripes);
+    for (size_t i = 0; i < stripes; i++)
+    {
+        const size_t begin = count * i / stripes;
+        const size_t end   = count * (i + 1) / stripes;
+        tasks.emplace_back([&task, begin, end] { task(begin, end); });
+    }
+    run(tasks);
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2006-2020 Istituto Italiano di Tecnologia (IIT)
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms of the
+ * BSD-3-Clause license. See the accompanying LICENSE file for details.
+ */
+
+#ifndef REALSENSE2_WORKER_POOL_H
+#define REALSENSE2_WORKER_POOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Persistent threads processing the images of a frameset in parallel.
+ * The thread calling run() executes tasks as well, also the ones of other batches while it waits,
+ * so a task may call run() again (e.g. to split its work in stripes) without deadlocks.
+ */
+class realsense2WorkerPool
+{
+public:
+    /**
+     * @param threads total number of threads, the calling one included
+     */
+    explicit realsense2WorkerPool(size_t threads);
+    ~realsense2WorkerPool();
+
+    realsense2WorkerPool(const realsense2WorkerPool&) = delete;
+    realsense2WorkerPool& operator=(const realsense2WorkerPool&) = delete;
+
+    size_t size() const;
+
+    /**
+     * Runs all the tasks and returns when they are completed.
+     */
+    void run(std::vector<std::function<void()>>& tasks);
+
+    /**
+     * Splits [0, count) in size() contiguous ranges and runs task(begin, end) on each of them.
+     */
+    void parallelFor(size_t count, const std::function<void(size_t, size_t)>& task);
+
+private:
+    struct batch
+    {
+        size_t pending{0};
+    };
+
+    struct job
+    {
+        std::function<void()>* task;
+        batch*                 owner;
+    };
+
+    void workerLoop();
+    // Must be called with the mutex locked, it unlocks it while the task runs
+    void execute(std::unique_lock<std::mutex>& lock);
+
+    std::vector<std::thread> m_threads;
+    std::deque<job>          m_jobs;
+    std::mutex               m_mutex;
+    // Signaled when a job is queued or a batch is completed
+    std::condition_variable  m_changed;
+    bool                     m_stopping{false};
+};
+
+#endif
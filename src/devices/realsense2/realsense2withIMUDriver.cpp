@@ -10,6 +10,7 @@
 
 #include <yarp/os/Value.h>
 #include <yarp/os/LogComponent.h>
+#include <yarp/os/Time.h>
 
 #include <yarp/sig/ImageUtils.h>
 
@@ -17,6 +18,7 @@
 #include <yarp/math/Math.h>
 
 #include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <cstdint>
 #include <iomanip>
@@ -72,9 +74,14 @@ struct float3 {
 
 class rotation_estimator
 {
-    // theta is the angle of camera rotation in x, y and z components
+    // theta is the angle of camera rotation in x, y and z components, only accessed by the thread feeding the samples
     float3 theta;
-    std::mutex theta_mtx;
+    // Copy of theta published for the readers: the sequence is odd while it is written (seqlock)
+    std::atomic<uint32_t> snapshot_seq{0};
+    std::atomic<float> snapshot_x{0};
+    std::atomic<float> snapshot_y{0};
+    std::atomic<float> snapshot_z{0};
+    std::atomic<double> snapshot_ts{0};
     /* alpha indicates the part that gyro and accelerometer take in computation of theta; higher alpha gives more weight to gyro, but too high
     values cause drift; lower alpha gives more weight to accelerometer, which is more sensitive to disturbances */
     float alpha = 0.98;
@@ -106,7 +113,6 @@ public:
         gyro_angle = gyro_angle * dt_gyro;
 
         // Apply the calculated change of angle to the current angle (theta)
-        std::lock_guard<std::mutex> lock(theta_mtx);
         theta.add(-gyro_angle.z, -gyro_angle.y, gyro_angle.x);
     }
 
@@ -121,7 +127,6 @@ public:
         accel_angle.y = 0; //ADDED by randaz81
 
         // If it is the first iteration, set initial pose of camera according to accelerometer data (note the different handling for Y axis)
-        std::lock_guard<std::mutex> lock(theta_mtx);
         if (first)
         {
             first = false;
@@ -142,11 +147,35 @@ public:
         }
     }
 
-    // Returns the current rotation angle
-    float3 get_theta()
+    // Makes the current rotation angle visible to get_theta(), stamped with the time of the last sample
+    void publish(double timestamp)
     {
-        std::lock_guard<std::mutex> lock(theta_mtx);
-        return theta;
+        uint32_t seq = snapshot_seq.load(std::memory_order_relaxed);
+        snapshot_seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        snapshot_x.store(theta.x, std::memory_order_relaxed);
+        snapshot_y.store(theta.y, std::memory_order_relaxed);
+        snapshot_z.store(theta.z, std::memory_order_relaxed);
+        snapshot_ts.store(timestamp, std::memory_order_relaxed);
+        snapshot_seq.store(seq + 2, std::memory_order_release);
+    }
+
+    // Returns the last published rotation angle, never blocks the thread feeding the samples
+    bool get_theta(float3& angle, double& timestamp) const
+    {
+        uint32_t before;
+        uint32_t after;
+        do
+        {
+            before = snapshot_seq.load(std::memory_order_acquire);
+            angle.x = snapshot_x.load(std::memory_order_relaxed);
+            angle.y = snapshot_y.load(std::memory_order_relaxed);
+            angle.z = snapshot_z.load(std::memory_order_relaxed);
+            timestamp = snapshot_ts.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = snapshot_seq.load(std::memory_order_relaxed);
+        } while (before != after || (before & 1) != 0);
+        return before != 0;
     }
 };
 
@@ -272,11 +301,11 @@ bool realsense2withIMUDriver::pipelineRestart()
 
 void realsense2Driver::fallback()
 {
-    m_cfg.enable_stream(RS2_STREAM_COLOR, m_color_intrin.width, m_color_intrin.height, RS2_FORMAT_RGB8, m_fps);
-    m_cfg.enable_stream(RS2_STREAM_DEPTH, m_depth_intrin.width, m_depth_intrin.height, RS2_FORMAT_Z16, m_fps);
+    m_cfg.enable_stream(RS2_STREAM_COLOR, m_color_intrin.width, m_color_intrin.height, RS2_FORMAT_RGB8, m_rgbFps);
+    m_cfg.enable_stream(RS2_STREAM_DEPTH, m_depth_intrin.width, m_depth_intrin.height, RS2_FORMAT_Z16, m_depthFps);
     yCWarning(REALSENSE2WITHIMU) << "Format not supported, use --verbose for more details. Setting the fallback format";
-    std::cout << "COLOR: " << m_color_intrin.width << "x" << m_color_intrin.height << " fps: " << m_fps << std::endl;
-    std::cout << "DEPTH: " << m_depth_intrin.width << "x" << m_depth_intrin.height << " fps: " << m_fps << std::endl;
+    std::cout << "COLOR: " << m_color_intrin.width << "x" << m_color_intrin.height << " fps: " << m_rgbFps << std::endl;
+    std::cout << "DEPTH: " << m_depth_intrin.width << "x" << m_depth_intrin.height << " fps: " << m_depthFps << std::endl;
 }
 #endif
 
@@ -296,12 +325,22 @@ bool realsense2withIMUDriver::open(Searchable& config)
     }
     else if (sensor_is == "d435i")
     {
-        b &= realsense2Driver::open(config);
         //m_sensor_has_pose_capabilities = false;
         m_sensor_has_orientation_estimator = true;
-        m_cfg.enable_stream(RS2_STREAM_ACCEL, RS2_FORMAT_MOTION_XYZ32F);
-        m_cfg.enable_stream(RS2_STREAM_GYRO, RS2_FORMAT_MOTION_XYZ32F);
-        b &= pipelineRestart();
+        m_rotation_estimator = new rotation_estimator();
+        // The motion streams are not part of the video pipeline, see startMotionSensor()
+        b &= realsense2Driver::open(config);
+        if (b && !startMotionSensor(config))
+        {
+            // A failed open() is not followed by close(): the video streaming is stopped and the device given back here
+            realsense2Driver::close();
+            b = false;
+        }
+        if (!b)
+        {
+            delete m_rotation_estimator;
+            m_rotation_estimator = nullptr;
+        }
     }
     /*
     //T265 is very diffcukt to implement without major refactoring.
@@ -327,10 +366,185 @@ bool realsense2withIMUDriver::open(Searchable& config)
 
 bool realsense2withIMUDriver::close()
 {
-    pipelineShutdown();
+    // A reconnection in progress would open the motion sensor again, with callbacks using the estimator
+    stopWatchdog();
+    stopMotionSensor();
+    delete m_rotation_estimator;
+    m_rotation_estimator = nullptr;
+    return realsense2Driver::close();
+}
+
+bool realsense2withIMUDriver::startMotionSensor(Searchable& config)
+{
+    if (config.check("imuBufferSize"))
+    {
+        m_imuBufferSize = config.find("imuBufferSize").asInt32();
+    }
+    m_gyroBuffer.reset(m_imuBufferSize);
+    m_accelBuffer.reset(m_imuBufferSize);
+    m_gyroCursors.clear();
+    m_accelCursors.clear();
+
+    // By default the fastest profile of each stream is used
+    m_gyroFps  = config.check("gyroFramerate")  ? config.find("gyroFramerate").asInt32()  : 0;
+    m_accelFps = config.check("accelFramerate") ? config.find("accelFramerate").asInt32() : 0;
+    return openMotionSensor();
+}
+
+bool realsense2withIMUDriver::openMotionSensor()
+{
+    m_motion_sensor = nullptr;
+    for (auto& sensor : m_sensors)
+    {
+        if (sensor.is<rs2::motion_sensor>())
+        {
+            m_motion_sensor = &sensor;
+        }
+    }
+    if (m_motion_sensor == nullptr)
+    {
+        yCError(REALSENSE2WITHIMU) << "The device has no motion sensor";
+        return false;
+    }
+
+    const int gyroFps  = m_gyroFps;
+    const int accelFps = m_accelFps;
+    rs2::stream_profile gyroProfile;
+    rs2::stream_profile accelProfile;
+    for (const auto& profile : m_motion_sensor->get_stream_profiles())
+    {
+        if (profile.format() != RS2_FORMAT_MOTION_XYZ32F)
+        {
+            continue;
+        }
+        if (profile.stream_type() == RS2_STREAM_GYRO &&
+            (gyroFps > 0 ? profile.fps() == gyroFps : (!gyroProfile || profile.fps() > gyroProfile.fps())))
+        {
+            gyroProfile = profile;
+        }
+        else if (profile.stream_type() == RS2_STREAM_ACCEL &&
+                 (accelFps > 0 ? profile.fps() == accelFps : (!accelProfile || profile.fps() > accelProfile.fps())))
+        {
+            accelProfile = profile;
+        }
+    }
+    if (!gyroProfile || !accelProfile)
+    {
+        yCError(REALSENSE2WITHIMU) << "Requested gyroscope or accelerometer framerate not supported";
+        return false;
+    }
+
+    try
+    {
+        m_motion_sensor->open(std::vector<rs2::stream_profile>{gyroProfile, accelProfile});
+        m_motion_sensor->start([this](rs2::frame frame) { onMotionFrame(frame); });
+    }
+    catch (const rs2::error& e)
+    {
+        yCError(REALSENSE2WITHIMU) << "Failed to start the motion sensor:" << "(" << e.what() << ")";
+        try
+        {
+            // The sensor may have been opened before start() failed
+            m_motion_sensor->close();
+        }
+        catch (const rs2::error&)
+        {
+        }
+        return false;
+    }
+    m_motionStarted = true;
+    yCInfo(REALSENSE2WITHIMU) << "Motion sensor started, gyroscope at" << gyroProfile.fps() << "Hz, accelerometer at" << accelProfile.fps() << "Hz";
     return true;
 }
 
+void realsense2withIMUDriver::deviceReconnected()
+{
+    // The sensor streaming before the disconnection has been replaced, the buffers are kept
+    m_motionStarted = false;
+    openMotionSensor();
+}
+
+void realsense2withIMUDriver::stopMotionSensor()
+{
+    if (!m_motionStarted)
+    {
+        return;
+    }
+    try
+    {
+        m_motion_sensor->stop();
+        m_motion_sensor->close();
+    }
+    catch (const rs2::error& e)
+    {
+        yCError(REALSENSE2WITHIMU) << "Failed to stop the motion sensor:" << "(" << e.what() << ")";
+    }
+    m_motionStarted = false;
+}
+
+void realsense2withIMUDriver::onMotionFrame(const rs2::frame& frame)
+{
+    // Runs in the librealsense sensor thread, it must never block
+    auto motion = frame.as<rs2::motion_frame>();
+    if (!motion)
+    {
+        return;
+    }
+    rs2_vector data = motion.get_motion_data();
+    realsense2ImuSample sample;
+    sample.frameTimestamp = motion.get_timestamp();
+    sample.timestamp = (m_timestamp_type == rs_timestamp) ? sample.frameTimestamp / 1000.0 : yarp::os::Time::now();
+    sample.x = data.x;
+    sample.y = data.y;
+    sample.z = data.z;
+
+    // The complementary filter is updated at the sensor rate, the getter only copies its snapshot
+    rs2_stream stream = motion.get_profile().stream_type();
+    if (stream == RS2_STREAM_GYRO)
+    {
+        m_gyroBuffer.push(sample);
+        if (m_rotation_estimator)
+        {
+            m_rotation_estimator->process_gyro(data, sample.frameTimestamp);
+            m_rotation_estimator->publish(sample.timestamp);
+        }
+    }
+    else if (stream == RS2_STREAM_ACCEL)
+    {
+        m_accelBuffer.push(sample);
+        if (m_rotation_estimator)
+        {
+            m_rotation_estimator->process_accel(data);
+            m_rotation_estimator->publish(sample.timestamp);
+        }
+    }
+}
+
+uint64_t& realsense2withIMUDriver::readCursor(std::map<std::thread::id, uint64_t>& cursors, const realsense2ImuBuffer& buffer)
+{
+    auto it = cursors.find(std::this_thread::get_id());
+    if (it == cursors.end())
+    {
+        // A new consumer starts from the oldest sample still in the buffer
+        uint64_t head = buffer.head();
+        uint64_t oldest = head > buffer.capacity() ? head - buffer.capacity() : 0;
+        it = cursors.emplace(std::this_thread::get_id(), oldest).first;
+    }
+    return it->second;
+}
+
+size_t realsense2withIMUDriver::getThreeAxisGyroscopeSamples(std::vector<realsense2ImuSample>& samples)
+{
+    std::lock_guard<std::mutex> guard(m_cursorMutex);
+    return m_gyroBuffer.read(readCursor(m_gyroCursors, m_gyroBuffer), samples);
+}
+
+size_t realsense2withIMUDriver::getThreeAxisLinearAccelerometerSamples(std::vector<realsense2ImuSample>& samples)
+{
+    std::lock_guard<std::mutex> guard(m_cursorMutex);
+    return m_accelBuffer.read(readCursor(m_accelCursors, m_accelBuffer), samples);
+}
+
 //---------------------------------------------------------------------------------------------------------------
 /* IThreeAxisGyroscopes methods */
 size_t realsense2withIMUDriver::getNrOfThreeAxisGyroscopes() const
@@ -364,25 +578,16 @@ bool realsense2withIMUDriver::getThreeAxisGyroscopeMeasure(size_t sens_index, ya
         return false;
     }
 
-    std::lock_guard<std::mutex> guard(realsense2Driver::m_mutex);
-    rs2::frameset dataframe;
-    try
-    {
-        dataframe = m_pipeline.wait_for_frames();
-    }
-    catch (const rs2::error& e)
+    realsense2ImuSample sample;
+    if (!m_gyroBuffer.latest(sample))
     {
-        yCError(REALSENSE2WITHIMU) << "m_pipeline.wait_for_frames() failed with error:"<< "(" << e.what() << ")";
-        m_lastError = e.what();
         return false;
     }
-    auto fg = dataframe.first(RS2_STREAM_GYRO, RS2_FORMAT_MOTION_XYZ32F);
-    rs2::motion_frame gyro = fg.as<rs2::motion_frame>();
-    m_last_gyro = gyro.get_motion_data();
     out.resize(3);
-    out[0] = m_last_gyro.x;
-    out[1] = m_last_gyro.y;
-    out[2] = m_last_gyro.z;
+    out[0] = sample.x;
+    out[1] = sample.y;
+    out[2] = sample.z;
+    timestamp = sample.timestamp;
     return true;
 }
 
@@ -416,25 +621,20 @@ bool realsense2withIMUDriver::getThreeAxisLinearAccelerometerFrameName(size_t se
 
 bool realsense2withIMUDriver::getThreeAxisLinearAccelerometerMeasure(size_t sens_index, yarp::sig::Vector& out, double& timestamp) const
 {
-    std::lock_guard<std::mutex> guard(m_mutex);
-    rs2::frameset dataframe;
-    try
-    {
-        dataframe = m_pipeline.wait_for_frames();
+    if (sens_index != 0) {
+        return false;
     }
-    catch (const rs2::error& e)
+
+    realsense2ImuSample sample;
+    if (!m_accelBuffer.latest(sample))
     {
-        yCError(REALSENSE2WITHIMU) << "m_pipeline.wait_for_frames() failed with error:"<< "(" << e.what() << ")";
-        m_lastError = e.what();
         return false;
     }
-    auto fa = dataframe.first(RS2_STREAM_ACCEL, RS2_FORMAT_MOTION_XYZ32F);
-    rs2::motion_frame accel = fa.as<rs2::motion_frame>();
-    m_last_accel = accel.get_motion_data();
     out.resize(3);
-    out[0] = m_last_accel.x;
-    out[1] = m_last_accel.y;
-    out[2] = m_last_accel.z;
+    out[0] = sample.x;
+    out[1] = sample.y;
+    out[2] = sample.z;
+    timestamp = sample.timestamp;
     return true;
 }
 
@@ -482,39 +682,11 @@ bool realsense2withIMUDriver::getOrientationSensorMeasureAsRollPitchYaw(size_t s
     if (sens_index != 0) { return false; }
     if (m_sensor_has_orientation_estimator)
     {
-        std::lock_guard<std::mutex> guard(m_mutex);
-        rs2::frameset dataframe;
-        try
+        float3 theta;
+        if (!m_rotation_estimator->get_theta(theta, timestamp))
         {
-            dataframe = m_pipeline.wait_for_frames();
-        }
-        catch (const rs2::error& e)
-        {
-            yCError(REALSENSE2WITHIMU) << "m_pipeline.wait_for_frames() failed with error:"<< "(" << e.what() << ")";
-            m_lastError = e.what();
             return false;
         }
-        auto motion = dataframe.as<rs2::motion_frame>();
-        if (motion && motion.get_profile().stream_type() == RS2_STREAM_GYRO &&
-                      motion.get_profile().format() == RS2_FORMAT_MOTION_XYZ32F)
-        {
-            // Get the timestamp of the current frame
-            double ts = motion.get_timestamp();
-            // Get gyro measures
-            rs2_vector gyro_data = motion.get_motion_data();
-            // Call function that computes the angle of motion based on the retrieved measures
-            m_rotation_estimator->process_gyro(gyro_data, ts);
-        }
-        // If casting succeeded and the arrived frame is from accelerometer stream
-        if (motion && motion.get_profile().stream_type() == RS2_STREAM_ACCEL &&
-                      motion.get_profile().format() == RS2_FORMAT_MOTION_XYZ32F)
-        {
-            // Get accelerometer measures
-            rs2_vector accel_data = motion.get_motion_data();
-            // Call function that computes the angle of motion based on the retrieved measures
-            m_rotation_estimator->process_accel(accel_data);
-        }
-        float3 theta = m_rotation_estimator->get_theta();
         rpy.resize(3);
         rpy[0] = 0 + theta.x * 180.0 / M_PI; //here we can eventually adjust the sign and/or sum an offset
         rpy[1] = 0 + theta.y * 180.0 / M_PI;
@@ -15,11 +15,13 @@
 #include <yarp/dev/MultipleAnalogSensorsInterfaces.h>
 
 #include "realsense2Driver.h"
+#include "realsense2ImuBuffer.h"
 #include <cstring>
 #include <iostream>
 #include <librealsense2/rs.hpp>
 #include <map>
 #include <mutex>
+#include <thread>
 
  /**********************************************************************************************************/
  // This software module is experimental.
@@ -80,7 +82,37 @@ public:
     bool getOrientationSensorFrameName(size_t sens_index, std::string& frameName) const override;
     bool getOrientationSensorMeasureAsRollPitchYaw(size_t sens_index, yarp::sig::Vector& rpy, double& timestamp) const override;
 
+    /**
+     * Batched reads: append all the samples received since the previous call of the same method from the
+     * same thread. Every consumer thread has its own cursor and receives all the samples, the first call
+     * of a thread returns the samples still in the buffer.
+     * @return the number of samples lost because the buffer was overrun
+     */
+    size_t getThreeAxisGyroscopeSamples(std::vector<realsense2ImuSample>& samples);
+    size_t getThreeAxisLinearAccelerometerSamples(std::vector<realsense2ImuSample>& samples);
+
 protected:
+    bool startMotionSensor(yarp::os::Searchable& config);
+    bool openMotionSensor();
+    void stopMotionSensor();
+    void deviceReconnected() override;
+    // Must be called with m_cursorMutex locked
+    uint64_t& readCursor(std::map<std::thread::id, uint64_t>& cursors, const realsense2ImuBuffer& buffer);
+    void onMotionFrame(const rs2::frame& frame);
+
+    // The motion sensor is opened outside the pipeline and fills the buffers from its callback
+    rs2::sensor*        m_motion_sensor{nullptr};
+    bool                m_motionStarted{false};
+    int                 m_imuBufferSize{1024};
+    // Requested framerates, 0 selects the fastest profile
+    int                 m_gyroFps{0};
+    int                 m_accelFps{0};
+    realsense2ImuBuffer m_gyroBuffer;
+    realsense2ImuBuffer m_accelBuffer;
+    std::mutex          m_cursorMutex;
+    std::map<std::thread::id, uint64_t> m_gyroCursors;
+    std::map<std::thread::id, uint64_t> m_accelCursors;
+
     // realsense classes
     mutable rs2_vector m_last_gyro;
     mutable rs2_vector m_last_accel;
@@ -102,7 +134,6 @@ protected:
     mutable std::string m_lastError;
 
     /*std::mutex   m_mutex;
-    rs2::context m_ctx;
     rs2::config m_cfg;
     rs2::pipeline m_pipeline;
     rs2::pipeline_profile m_profile;